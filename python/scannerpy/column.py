@@ -6,6 +6,7 @@ from stdlib import parsers
 from subprocess import Popen, PIPE
 import tempfile
 import os
+import mmap
 
 class Column:
     """
@@ -36,11 +37,30 @@ class Column:
         path = '{}/tables/{}/{}_{}.bin'.format(
             self._db_path, self._table._descriptor.id,
             self._descriptor.id, item_id)
+        if self._db.config.storage_type == 'posix':
+            # Map the file so only the requested elements are copied out of
+            # it, instead of reading the whole item into memory
+            try:
+                with open(path, 'rb') as f:
+                    contents = mmap.mmap(f.fileno(), 0,
+                                         access=mmap.ACCESS_READ)
+            except IOError:
+                raise ScannerException('Path {} does not exist'.format(path))
+            try:
+                for buf in self._load_elements(contents, rows, fn):
+                    yield buf
+            finally:
+                contents.close()
+            return
+
         try:
             contents = self._storage.read(path)
         except UserWarning:
             raise ScannerException('Path {} does not exist'.format(path))
+        for buf in self._load_elements(contents, rows, fn):
+            yield buf
 
+    def _load_elements(self, contents, rows, fn=None):
         lens = []
         start_pos = None
         pos = 0
@@ -60,7 +80,7 @@ class Column:
         rows_idx = 0
         i = 8 + num_rows * 8 + start_pos
         for j, buf_len in enumerate(lens):
-            if j < len(rows) and j == rows[rows_idx]:
+            if rows_idx < len(rows) and j == rows[rows_idx]:
                 buf = contents[i:i+buf_len]
                 if fn is not None:
                     yield fn(buf, self._db)
@@ -69,6 +89,22 @@ class Column:
                 rows_idx += 1
             i += buf_len
 
+    def _load_row_ids(self, item_id):
+        """
+        Returns the offsets within the item of the rows stored for it, for
+        tables whose ops dropped some of their rows, or None if the item kept
+        all of its rows.
+        """
+        path = '{}/tables/{}/rows_{}.bin'.format(
+            self._db_path, self._table._descriptor.id, item_id)
+        try:
+            contents = self._storage.read(path)
+        except UserWarning:
+            return None
+        (num_rows,) = struct.unpack("=Q", contents[:8])
+        return list(struct.unpack("={}q".format(num_rows),
+                                  contents[8:8 + num_rows * 8]))
+
     def _load(self, fn=None, rows=None):
         table_descriptor = self._table._descriptor
         total_rows = table_descriptor.end_rows[-1]
@@ -96,7 +132,25 @@ class Column:
                     rows_idx += 1
                 else:
                     break
-            if select_rows:
+            row_ids = None
+            if select_rows and table_descriptor.sparse_rows:
+                row_ids = self._load_row_ids(item_id)
+            if row_ids is not None:
+                # Only some rows were stored, so look up where the requested
+                # ones ended up and skip the ones that were dropped
+                stored = {r: idx for idx, r in enumerate(row_ids)}
+                kept_rows = [r for r in select_rows if r in stored]
+                stored_rows = [stored[r] for r in kept_rows]
+                if stored_rows:
+                    outputs = self._load_output_file(item_id, stored_rows, fn)
+                    for r, output in zip(kept_rows, outputs):
+                        yield (start_row + r, output)
+            elif select_rows and table_descriptor.sparse_rows:
+                # The item kept all of its rows
+                outputs = self._load_output_file(item_id, select_rows, fn)
+                for r, output in zip(select_rows, outputs):
+                    yield (start_row + r, output)
+            elif select_rows:
                 for output in self._load_output_file(item_id, select_rows, fn):
                     yield (input_rows[i], output)
                     i += 1
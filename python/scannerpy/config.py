@@ -59,6 +59,7 @@ class Config(object):
     def _make_storage_config(self, config):
         storage = config['storage']
         storage_type = storage['type']
+        self.storage_type = storage_type
         self.db_path = str(storage['db_path'])
         if storage_type == 'posix':
             storage_config = StorageConfig.make_posix_config()
@@ -548,7 +548,7 @@ class Database:
 
         return self.collection(collection_name)
 
-    def ingest_videos(self, videos, force=False):
+    def ingest_videos(self, videos, force=False, num_threads=None):
         """
         Creates a Table from a video.
 
@@ -558,6 +558,8 @@ class Database:
 
         Kwargs:
             force: TODO(wcrichto)
+            num_threads: Number of videos the master ingests at once. Defaults
+                to one per core of the master.
 
         Returns:
             (list of created Tables, list of (path, reason) failures to ingest)
@@ -579,6 +581,8 @@ class Database:
         ingest_params = self.protobufs.IngestParameters()
         ingest_params.table_names.extend(table_names)
         ingest_params.video_paths.extend(paths)
+        if num_threads is not None:
+            ingest_params.num_threads = num_threads
         ingest_result = self._try_rpc(
             lambda: self._master.IngestVideos(ingest_params))
         if not ingest_result.result.success:
@@ -10,10 +10,11 @@ class TableSampler:
         self._table = table
         self._db = table._db
 
-    def all(self, item_size=1000, warmup_size=0):
+    def all(self, item_size=1000, warmup_size=0, align_to_keyframes=False):
         sampler_args = self._db.protobufs.AllSamplerArgs()
         sampler_args.sample_size = item_size
         sampler_args.warmup_size = warmup_size
+        sampler_args.align_to_keyframes = align_to_keyframes
         task = self._db.protobufs.Task()
         #task.output_table_name = output_table_name
         column_names = [c.name() for c in self._table.columns()]
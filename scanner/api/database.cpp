@@ -163,6 +163,7 @@ internal::DatabaseParameters machine_params_to_db_params(
   db.num_load_workers = params.num_load_workers;
   db.num_save_workers = params.num_save_workers;
   db.gpu_ids = params.gpu_ids;
+  db.frame_cache_size = params.frame_cache_size;
   return db;
 }
 }
@@ -172,6 +173,7 @@ MachineParameters default_machine_params() {
   machine_params.num_cpus = std::thread::hardware_concurrency();
   machine_params.num_load_workers = 2;
   machine_params.num_save_workers = 2;
+  machine_params.frame_cache_size = 0;
 #ifdef HAVE_CUDA
   i32 gpu_count;
   CU_CHECK(cudaGetDeviceCount(&gpu_count));
@@ -245,7 +247,7 @@ Result Database::start_worker(const MachineParameters& machine_params,
 Result Database::ingest_videos(const std::vector<std::string>& table_names,
                                const std::vector<std::string>& paths,
                                std::vector<FailedVideo>& failed_videos) {
-  internal::ingest_videos(storage_config_, db_path_, table_names, paths,
+  internal::ingest_videos(storage_config_, db_path_, table_names, paths, 0,
                           failed_videos);
   Result result;
   result.set_success(true);
@@ -33,6 +33,7 @@ struct MachineParameters {
   i32 num_save_workers;
   std::vector<i32>
       gpu_ids;  //!< List of CUDA device IDs that Scanner should use.
+  i64 frame_cache_size;  //!< Bytes of decoded frames to cache, 0 disables.
 };
 
 //! Pick smart defaults for the current machine.
@@ -28,6 +28,21 @@ Element::Element(Frame* frame)
 
 Kernel::Kernel(const Config& config) {}
 
+bool Kernel::take_selected_rows(std::vector<i32>& rows) {
+  if (!rows_selected_) {
+    return false;
+  }
+  rows.swap(selected_rows_);
+  selected_rows_.clear();
+  rows_selected_ = false;
+  return true;
+}
+
+void Kernel::select_rows(const std::vector<i32>& rows) {
+  selected_rows_ = rows;
+  rows_selected_ = true;
+}
+
 void VideoKernel::check_frame(const DeviceHandle& device,
                               const Element& element) {
   const Frame* frame = element.as_const_frame();
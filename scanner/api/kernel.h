@@ -146,12 +146,30 @@ class Kernel {
   //! Do not call this function.
   virtual void set_profiler(Profiler* profiler) { profiler_ = profiler; }
 
+  //! Do not call this function.
+  bool take_selected_rows(std::vector<i32>& rows);
+
  protected:
+  /**
+   * @brief Keeps only a subset of the input rows of the current batch.
+   *
+   * Only ops registered with OpBuilder::filter() may call this, from within
+   * execute. rows holds the increasing indices of the input rows that
+   * survive and the op must produce output elements for just those rows.
+   * Later ops only see the surviving rows and the output table records
+   * which rows they were.
+   */
+  void select_rows(const std::vector<i32>& rows);
+
   /**
    * The profiler allows an op to save profiling data for later
    * visualization. It is not guaranteed to be non-null, so check before use.
    */
   Profiler* profiler_ = nullptr;
+
+ private:
+  bool rows_selected_ = false;
+  std::vector<i32> selected_rows_;
 };
 
 //! Kernel with support for frame and frame_info columns.
@@ -55,6 +55,7 @@ namespace internal {
 OpRegistration::OpRegistration(const OpBuilder& builder) {
   const std::string& name = builder.name_;
   const bool variadic_inputs = builder.variadic_inputs_;
+  const bool can_filter = builder.can_filter_;
   std::vector<Column> input_columns;
   size_t i = 0;
   for (auto& name_type : builder.input_columns_) {
@@ -73,8 +74,8 @@ OpRegistration::OpRegistration(const OpBuilder& builder) {
     col.set_type(std::get<1>(name_type));
     output_columns.push_back(col);
   }
-  OpInfo* info =
-      new OpInfo(name, variadic_inputs, input_columns, output_columns);
+  OpInfo* info = new OpInfo(name, variadic_inputs, input_columns,
+                            output_columns, can_filter, builder.frame_formats_);
   OpRegistry* registry = get_op_registry();
   registry->add_op(name, info);
 }
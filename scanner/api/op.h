@@ -15,9 +15,12 @@
 
 #pragma once
 
+#include "scanner/api/frame.h"
 #include "scanner/util/common.h"
 #include "scanner/util/profiler.h"
 
+#include <functional>
+#include <map>
 #include <vector>
 
 namespace scanner {
@@ -69,6 +72,16 @@ Op* make_input_op(const std::vector<std::string>& columns);
 
 Op* make_output_op(const std::vector<OpInput>& inputs);
 
+/**
+ * @brief Computes the frame shape an op would like a frame input decoded to.
+ *
+ * Given the serialized op args and the shape of the stored video frames,
+ * returns a (height, width, channels) U8 shape with 1 (gray) or 3 (RGB)
+ * channels.
+ */
+using FrameFormatFn = std::function<FrameInfo(const std::vector<u8>& args,
+                                              const FrameInfo& video)>;
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Implementation Details
 namespace internal {
@@ -84,7 +97,8 @@ class OpBuilder {
  public:
   friend class OpRegistration;
 
-  OpBuilder(const std::string& name) : name_(name), variadic_inputs_(false) {}
+  OpBuilder(const std::string& name)
+    : name_(name), variadic_inputs_(false), can_filter_(false) {}
 
   OpBuilder& variadic_inputs() {
     if (input_columns_.size() > 0) {
@@ -119,9 +133,30 @@ class OpBuilder {
     return output(name, ColumnType::Video);
   }
 
+  //! Allows the op's kernels to drop rows with Kernel::select_rows.
+  OpBuilder& filter() {
+    can_filter_ = true;
+    return *this;
+  }
+
+  /**
+   * Lets the frames of a frame input be decoded straight to the shape given
+   * by format, e.g. downscaled or gray, in the same pass that converts them
+   * from the video's pixel format. This is only done for CPU kernels reading
+   * a video column of the input table, when every op reading the column
+   * asks for the same shape. Kernels still get full resolution RGB frames
+   * otherwise, so they must accept both.
+   */
+  OpBuilder& frame_format(const std::string& input, FrameFormatFn format) {
+    frame_formats_[input] = format;
+    return *this;
+  }
+
  private:
   std::string name_;
   bool variadic_inputs_;
+  bool can_filter_;
+  std::map<std::string, FrameFormatFn> frame_formats_;
   std::vector<std::tuple<std::string, ColumnType>> input_columns_;
   std::vector<std::tuple<std::string, ColumnType>> output_columns_;
 };
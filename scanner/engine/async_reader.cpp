@@ -0,0 +1,198 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/async_reader.h"
+#include "scanner/util/storehouse.h"
+
+#include <algorithm>
+#include <cstring>
+
+using storehouse::RandomReadFile;
+using storehouse::StoreResult;
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+// Files each read thread keeps open. Reads of an io item mostly hit the same
+// few items, so this only needs to cover the items in flight.
+const size_t MAX_OPEN_FILES = 64;
+}
+
+void ReadBatch::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return remaining_ == 0; });
+}
+
+bool ReadBatch::done() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return remaining_ == 0;
+}
+
+void ReadBatch::finish(i32 reads) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  remaining_ -= reads;
+  if (remaining_ == 0) {
+    done_.notify_all();
+  }
+}
+
+AsyncReader::AsyncReader(storehouse::StorageConfig* storage_config,
+                         i32 num_threads)
+  : storage_config_(storage_config), reads_(num_threads * 64) {
+  for (i32 i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&AsyncReader::thread_main, this);
+  }
+}
+
+AsyncReader::~AsyncReader() {
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    reads_.push(nullptr);
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+std::shared_ptr<ReadBatch> AsyncReader::submit(
+    std::vector<ReadRequest> requests) {
+  auto batch = std::make_shared<ReadBatch>();
+  std::sort(requests.begin(), requests.end(),
+            [](const ReadRequest& a, const ReadRequest& b) {
+              return std::tie(a.path, a.offset) < std::tie(b.path, b.offset);
+            });
+
+  // Merge requests for nearby ranges of the same file into one read
+  std::vector<std::shared_ptr<Read>> reads;
+  for (ReadRequest& request : requests) {
+    if (request.size == 0) {
+      continue;
+    }
+    if (!reads.empty()) {
+      Read& read = *reads.back();
+      const ReadRequest& last = read.requests.back();
+      u64 read_end = read.offset + read.size;
+      u64 request_end = request.offset + request.size;
+      if (request.path == read.path &&
+          request.offset <= read_end + MAX_COALESCE_GAP &&
+          std::max(read_end, request_end) - read.offset <=
+              MAX_COALESCED_READ_SIZE) {
+        read.direct = read.direct &&
+                      request.offset == last.offset + last.size &&
+                      request.buffer == last.buffer + last.size;
+        read.size = std::max(read_end, request_end) - read.offset;
+        read.requests.push_back(std::move(request));
+        continue;
+      }
+    }
+    auto read = std::make_shared<Read>();
+    read->batch = batch;
+    read->path = request.path;
+    read->offset = request.offset;
+    read->size = request.size;
+    read->direct = true;
+    read->requests.push_back(std::move(request));
+    reads.push_back(read);
+  }
+
+  batch->remaining_ = reads.size();
+  {
+    std::unique_lock<std::mutex> lock(stats_mutex_);
+    stats_.requests += requests.size();
+  }
+  for (auto& read : reads) {
+    reads_.push(read);
+  }
+  return batch;
+}
+
+AsyncReader::Stats AsyncReader::stats() {
+  std::unique_lock<std::mutex> lock(stats_mutex_);
+  Stats stats = stats_;
+  if (outstanding_ > 0) {
+    stats.busy_ns += nano_since(busy_start_);
+  }
+  return stats;
+}
+
+void AsyncReader::thread_main() {
+  storehouse::StorageBackend* storage =
+      storehouse::StorageBackend::make_from_config(storage_config_);
+  FileMap files;
+  while (true) {
+    std::shared_ptr<Read> read;
+    reads_.pop(read);
+    if (read == nullptr) {
+      break;
+    }
+
+    auto read_start = now();
+    {
+      std::unique_lock<std::mutex> lock(stats_mutex_);
+      if (outstanding_++ == 0) {
+        busy_start_ = read_start;
+      }
+    }
+    perform(storage, files, *read);
+    auto read_end = now();
+    {
+      std::unique_lock<std::mutex> lock(stats_mutex_);
+      stats_.reads++;
+      stats_.bytes += read->size;
+      stats_.read_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            read_end - read_start)
+                            .count();
+      if (--outstanding_ == 0) {
+        stats_.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              read_end - busy_start_)
+                              .count();
+      }
+    }
+    read->batch->finish(1);
+  }
+  files.clear();
+  delete storage;
+}
+
+void AsyncReader::perform(storehouse::StorageBackend* storage, FileMap& files,
+                          Read& read) {
+  auto it = files.find(read.path);
+  if (it == files.end()) {
+    if (files.size() >= MAX_OPEN_FILES) {
+      files.clear();
+    }
+    std::unique_ptr<RandomReadFile> file;
+    BACKOFF_FAIL(
+        storehouse::make_unique_random_read_file(storage, read.path, file));
+    it = files.emplace(read.path, std::move(file)).first;
+  }
+  RandomReadFile* file = it->second.get();
+
+  u64 pos = read.offset;
+  if (read.direct) {
+    s_read(file, read.requests[0].buffer, read.size, pos);
+    return;
+  }
+  // Scatter the merged range into the buffers of each request
+  std::vector<u8> data(read.size);
+  s_read(file, data.data(), read.size, pos);
+  for (const ReadRequest& request : read.requests) {
+    memcpy(request.buffer, data.data() + (request.offset - read.offset),
+           request.size);
+  }
+}
+}
+}
@@ -0,0 +1,130 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "scanner/util/queue.h"
+#include "scanner/util/util.h"
+#include "storehouse/storage_backend.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+// Threads issuing reads for a node. Storage latency rather than bandwidth
+// bounds most reads, so this is well above the number of cores.
+static const i32 DEFAULT_ASYNC_READ_THREADS = 16;
+
+// Reads separated by at most this many bytes in the same file are issued as
+// a single read
+static const u64 MAX_COALESCE_GAP = 256 * 1024;
+
+// Coalescing stops once a read would grow beyond this many bytes
+static const u64 MAX_COALESCED_READ_SIZE = 64 * 1024 * 1024;
+
+struct ReadRequest {
+  std::string path;
+  u64 offset;
+  u64 size;
+  u8* buffer;
+};
+
+/// Reads submitted together, which complete as a unit.
+class ReadBatch {
+ public:
+  // Blocks until every read of the batch has landed in its buffer
+  void wait();
+
+  bool done();
+
+ private:
+  friend class AsyncReader;
+
+  void finish(i32 reads);
+
+  std::mutex mutex_;
+  std::condition_variable done_;
+  i32 remaining_ = 0;
+};
+
+/// Thread pool which performs reads for all load threads of a node.
+///
+/// Load threads used to block on each read in turn, so no more reads than
+/// load threads were ever outstanding. Batches are instead queued and served
+/// by many threads, and reads of neighbouring ranges of a file are merged.
+/// Each thread owns its own storage backend and keeps recently used files
+/// open, since backends and files are not thread safe.
+class AsyncReader {
+ public:
+  struct Stats {
+    // Reads as submitted and as issued to storage after coalescing
+    i64 requests = 0;
+    i64 reads = 0;
+    i64 bytes = 0;
+    // Time during which at least one read was outstanding
+    i64 busy_ns = 0;
+    // Sum of the durations of all reads. Divided by busy_ns, this is the
+    // average number of reads outstanding while busy.
+    i64 read_ns = 0;
+  };
+
+  AsyncReader(storehouse::StorageConfig* storage_config, i32 num_threads);
+
+  ~AsyncReader();
+
+  std::shared_ptr<ReadBatch> submit(std::vector<ReadRequest> requests);
+
+  Stats stats();
+
+ private:
+  struct Read {
+    std::shared_ptr<ReadBatch> batch;
+    std::string path;
+    u64 offset;
+    u64 size;
+    // Requests served by this read. Their buffers are filled straight from
+    // storage if they are back to back in memory and in the file.
+    std::vector<ReadRequest> requests;
+    bool direct;
+  };
+
+  using FileMap =
+      std::map<std::string, std::unique_ptr<storehouse::RandomReadFile>>;
+
+  void thread_main();
+
+  void perform(storehouse::StorageBackend* storage, FileMap& files,
+               Read& read);
+
+  storehouse::StorageConfig* storage_config_;
+  Queue<std::shared_ptr<Read>> reads_;
+  std::vector<std::thread> threads_;
+
+  std::mutex stats_mutex_;
+  Stats stats_;
+  i32 outstanding_ = 0;
+  timepoint_t busy_start_;
+};
+}
+}
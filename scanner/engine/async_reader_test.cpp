@@ -0,0 +1,96 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/async_reader.h"
+#include "scanner/util/fs.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace scanner {
+namespace internal {
+namespace {
+
+std::string write_test_file(size_t size) {
+  std::string path;
+  temp_file(path);
+  std::ofstream file(path, std::ios::binary);
+  for (size_t i = 0; i < size; ++i) {
+    file.put(static_cast<char>(i % 251));
+  }
+  return path;
+}
+
+void expect_file_contents(const u8* buffer, u64 offset, u64 size) {
+  for (u64 i = 0; i < size; ++i) {
+    ASSERT_EQ(buffer[i], static_cast<u8>((offset + i) % 251));
+  }
+}
+}
+
+TEST(AsyncReader, CoalescesNearbyReads) {
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+  AsyncReader reader(sc.get(), 4);
+  std::string a = write_test_file(4 * 1024 * 1024);
+  std::string b = write_test_file(1024);
+
+  std::vector<u8> contiguous(3000);
+  std::vector<u8> scattered(3 * 100);
+  std::vector<u8> far(100);
+  std::vector<u8> other(1024);
+  std::vector<ReadRequest> requests = {
+      // Back to back in the file and in memory
+      {a, 1000, 1000, contiguous.data()},
+      {a, 2000, 2000, contiguous.data() + 1000},
+      // Small gaps, so read together and scattered into place
+      {a, 10000, 100, scattered.data()},
+      {a, 10200, 100, scattered.data() + 100},
+      {a, 10150, 100, scattered.data() + 200},
+      // Too far away to be merged
+      {a, 3 * 1024 * 1024, 100, far.data()},
+      {b, 0, 1024, other.data()},
+  };
+  reader.submit(requests)->wait();
+
+  expect_file_contents(contiguous.data(), 1000, 3000);
+  expect_file_contents(scattered.data(), 10000, 100);
+  expect_file_contents(scattered.data() + 100, 10200, 100);
+  expect_file_contents(scattered.data() + 200, 10150, 100);
+  expect_file_contents(far.data(), 3 * 1024 * 1024, 100);
+  expect_file_contents(other.data(), 0, 1024);
+
+  AsyncReader::Stats stats = reader.stats();
+  EXPECT_EQ(stats.requests, requests.size());
+  EXPECT_EQ(stats.reads, 3);
+  EXPECT_GT(stats.busy_ns, 0);
+  EXPECT_GE(stats.read_ns, stats.busy_ns);
+
+  std::remove(a.c_str());
+  std::remove(b.c_str());
+}
+
+TEST(AsyncReader, EmptyBatchIsDone) {
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+  AsyncReader reader(sc.get(), 1);
+  std::shared_ptr<ReadBatch> batch = reader.submit({});
+  EXPECT_TRUE(batch->done());
+  batch->wait();
+}
+}
+}
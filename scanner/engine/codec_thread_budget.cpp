@@ -0,0 +1,93 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scanner/engine/codec_thread_budget.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+namespace scanner {
+namespace internal {
+namespace {
+
+// Reads the CPU time of the whole machine, in clock ticks. Returns false
+// where /proc/stat is not available.
+bool read_cpu_ticks(u64& idle, u64& total) {
+  std::ifstream stat("/proc/stat");
+  std::string cpu;
+  // user, nice, system, idle, iowait, irq, softirq and steal time
+  u64 ticks[8];
+  stat >> cpu;
+  for (u64& t : ticks) {
+    stat >> t;
+  }
+  if (!stat || cpu != "cpu") {
+    return false;
+  }
+  idle = ticks[3] + ticks[4];
+  total = 0;
+  for (u64 t : ticks) {
+    total += t;
+  }
+  return true;
+}
+}
+
+CodecThreadBudget::CodecThreadBudget() : last_sample_time_(now()) {
+  read_cpu_ticks(last_idle_ticks_, last_total_ticks_);
+}
+
+void CodecThreadBudget::start_job(i32 cores, i32 contexts) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cores_ = std::max(cores, 1);
+  contexts_ = std::max(contexts, 1);
+  // Time idle between jobs says nothing about the load of this one
+  sample();
+  idle_fraction_ = 0;
+}
+
+i32 CodecThreadBudget::context_threads() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (nano_since(last_sample_time_) >= CODEC_BUDGET_SAMPLE_INTERVAL * 1e9) {
+    sample();
+  }
+  i32 idle_cores = static_cast<i32>(idle_fraction_ * cores_);
+  i32 threads = (cores_ + idle_cores) / contexts_;
+  return std::min(std::max(threads, 1), MAX_CODEC_THREADS);
+}
+
+f64 CodecThreadBudget::idle_fraction() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return idle_fraction_;
+}
+
+void CodecThreadBudget::sample() {
+  u64 idle;
+  u64 total;
+  if (!read_cpu_ticks(idle, total)) {
+    return;
+  }
+  if (total > last_total_ticks_) {
+    idle_fraction_ = static_cast<f64>(idle - last_idle_ticks_) /
+                     (total - last_total_ticks_);
+  }
+  last_idle_ticks_ = idle;
+  last_total_ticks_ = total;
+  last_sample_time_ = now();
+}
+}
+}
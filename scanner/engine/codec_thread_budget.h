@@ -0,0 +1,68 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "scanner/util/util.h"
+
+#include <mutex>
+
+namespace scanner {
+namespace internal {
+
+// Threads a single codec context uses at most
+static const i32 MAX_CODEC_THREADS = 16;
+
+// How often the idle time of the node is sampled, in seconds
+static const f64 CODEC_BUDGET_SAMPLE_INTERVAL = 1.0;
+
+/// Sizes the threads of the libavcodec contexts of a node.
+///
+/// Each pipeline instance opens its own decoder and encoder contexts, which
+/// used to start four threads each. Nodes running many pipeline instances
+/// ran several codec threads per core, competing with the kernels. The
+/// budget instead shares the cores given to a job between all of its codec
+/// contexts. Contexts opened while the node has idle cores, such as encoders
+/// configured for each output item, also take a share of the idle cores.
+class CodecThreadBudget {
+ public:
+  CodecThreadBudget();
+
+  // Shares cores between the given number of codec contexts of the next job
+  void start_job(i32 cores, i32 contexts);
+
+  // Threads for a codec context opened now
+  i32 context_threads();
+
+  // Fraction of the CPU time of the node spent idle in the last sample
+  // interval of the current job
+  f64 idle_fraction();
+
+ private:
+  // Reads the idle time of the node since the previous sample
+  void sample();
+
+  std::mutex mutex_;
+  i32 cores_ = 1;
+  i32 contexts_ = 1;
+  timepoint_t last_sample_time_;
+  u64 last_idle_ticks_ = 0;
+  u64 last_total_ticks_ = 0;
+  f64 idle_fraction_ = 0;
+};
+}
+}
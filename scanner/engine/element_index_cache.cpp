@@ -0,0 +1,106 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/element_index_cache.h"
+#include "scanner/engine/metadata.h"
+#include "scanner/util/storehouse.h"
+
+namespace scanner {
+namespace internal {
+
+ElementIndex::ElementIndex(std::unique_ptr<storehouse::RandomReadFile> file,
+                           bool map_file)
+  : path_(file->path()) {
+  // Item files start with the number of elements and then each element size
+  u64 pos = 0;
+  u64 num_elements = s_read<u64>(file.get(), pos);
+  std::vector<i64> element_sizes(num_elements);
+  if (num_elements > 0) {
+    s_read(file.get(), reinterpret_cast<u8*>(element_sizes.data()),
+           element_sizes.size() * sizeof(i64), pos);
+  }
+  offsets_.reserve(num_elements + 1);
+  offsets_.push_back(pos);
+  for (i64 size : element_sizes) {
+    offsets_.push_back(offsets_.back() + size);
+  }
+  if (map_file) {
+    mapped_file_.reset(new MappedFile(path_));
+  }
+}
+
+u8* ElementIndex::map(i64 start, i64 end, i32 refs) {
+  assert(mapped());
+  return mapped_file_->map_block(offsets_[start], range_size(start, end), refs,
+                                 false);
+}
+
+ElementIndexCache::ElementIndexCache(storehouse::StorageConfig* storage_config,
+                                     size_t max_items)
+  : max_items_(max_items),
+    map_files_(is_posix_storage(storage_config)),
+    storage_(storehouse::StorageBackend::make_from_config(storage_config)) {}
+
+ElementIndexCache::~ElementIndexCache() {
+  lru_.clear();
+  entries_.clear();
+  delete storage_;
+}
+
+std::shared_ptr<ElementIndex> ElementIndexCache::get(i32 table_id,
+                                                     i32 column_id,
+                                                     i32 item_id) {
+  Key key = std::make_tuple(table_id, column_id, item_id);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->second;
+    }
+  }
+
+  // Read the header of the item without holding the cache lock
+  std::unique_ptr<storehouse::RandomReadFile> file;
+  {
+    std::unique_lock<std::mutex> lock(storage_mutex_);
+    BACKOFF_FAIL(storehouse::make_unique_random_read_file(
+        storage_, table_item_output_path(table_id, column_id, item_id),
+        file));
+  }
+  auto index = std::make_shared<ElementIndex>(std::move(file), map_files_);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    // Another load thread opened the same item concurrently
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->second;
+  }
+  lru_.emplace_front(key, index);
+  entries_[key] = lru_.begin();
+  while (lru_.size() > max_items_) {
+    entries_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  return index;
+}
+
+size_t ElementIndexCache::size() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return lru_.size();
+}
+}
+}
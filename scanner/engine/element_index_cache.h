@@ -0,0 +1,106 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/engine/mapped_file.h"
+#include "scanner/util/common.h"
+#include "storehouse/storage_backend.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+// Items indexed by each node. Mapped items keep their file open, so this is
+// well below common file descriptor limits.
+static const size_t DEFAULT_ELEMENT_INDEX_CACHE_ITEMS = 512;
+
+/// The file position of each element in an item file of a non-video column.
+class ElementIndex {
+ public:
+  // Reads the element sizes from the header of file. If map_file is set, the
+  // file is also mapped so that elements can be handed out without reading.
+  ElementIndex(std::unique_ptr<storehouse::RandomReadFile> file,
+               bool map_file);
+
+  const std::string& path() const { return path_; }
+
+  i64 num_elements() const { return offsets_.size() - 1; }
+
+  u64 element_offset(i64 element) const { return offsets_[element]; }
+
+  u64 element_size(i64 element) const {
+    return offsets_[element + 1] - offsets_[element];
+  }
+
+  // Total size of the elements in [start, end)
+  u64 range_size(i64 start, i64 end) const {
+    return offsets_[end] - offsets_[start];
+  }
+
+  bool mapped() const { return mapped_file_ != nullptr; }
+
+  // Returns the elements in [start, end) as a block buffer of refs elements
+  // which points into the file mapping. Only valid if mapped().
+  u8* map(i64 start, i64 end, i32 refs);
+
+ private:
+  std::string path_;
+  std::unique_ptr<MappedFile> mapped_file_;
+  // File position of each element followed by the end of the last one
+  std::vector<u64> offsets_;
+};
+
+/// Node-wide cache of ElementIndex entries keyed by (table, column, item).
+///
+/// Reading an item used to reread its size header for every io item that
+/// touched it. Items are immutable once written and table ids are never
+/// reused, so entries never go stale. The least recently used entries are
+/// dropped once more than max_items are cached. Items of a database on posix
+/// storage are memory mapped.
+class ElementIndexCache {
+ public:
+  ElementIndexCache(storehouse::StorageConfig* storage_config,
+                    size_t max_items);
+
+  ~ElementIndexCache();
+
+  std::shared_ptr<ElementIndex> get(i32 table_id, i32 column_id,
+                                    i32 item_id);
+
+  size_t size() const;
+
+ private:
+  using Key = std::tuple<i32, i32, i32>;
+  using Entry = std::pair<Key, std::shared_ptr<ElementIndex>>;
+
+  const size_t max_items_;
+  const bool map_files_;
+  // Storage backends are not thread safe, so opens are serialized
+  std::mutex storage_mutex_;
+  storehouse::StorageBackend* storage_;
+  mutable std::mutex mutex_;
+  // Most recently used entries are kept at the front
+  std::list<Entry> lru_;
+  std::map<Key, std::list<Entry>::iterator> entries_;
+};
+}
+}
@@ -2,15 +2,122 @@
 
 #include "scanner/engine/op_registry.h"
 #include "scanner/util/cuda.h"
-#include "scanner/video/decoder_automata.h"
+#include "scanner/video/gop_decoder_pool.h"
 #include "scanner/video/video_encoder.h"
 
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <algorithm>
 #include <thread>
 
 namespace scanner {
 namespace internal {
+namespace {
+
+// Fills buffer with num_rows frames starting at row start of an io item,
+// copying the cached ones and decoding runs of uncached ones. Decoded frames
+// are inserted into the cache. Returns the number of bytes evicted.
+i64 get_frames_through_cache(FrameCache& cache, GopDecoderPool* decoder,
+                             DeviceHandle buffer_handle, size_t frame_size,
+                             const std::vector<FrameCache::FrameData>& cached,
+                             const std::vector<FrameCacheKey>& keys,
+                             i64 start, i64 num_rows, u8* buffer) {
+  i64 evicted_bytes = 0;
+  std::vector<u8> host_frame;
+  i64 n = 0;
+  while (n < num_rows) {
+    const FrameCache::FrameData& data = cached[start + n];
+    if (data) {
+      memcpy_buffer(buffer + frame_size * n, buffer_handle, data->data(),
+                    CPU_DEVICE, frame_size);
+      n++;
+      continue;
+    }
+    i64 run_end = n + 1;
+    while (run_end < num_rows && !cached[start + run_end]) {
+      run_end++;
+    }
+    decoder->get_frames(buffer + frame_size * n, run_end - n);
+    for (i64 i = n; i < run_end; ++i) {
+      const u8* frame = buffer + frame_size * i;
+      if (buffer_handle.type != DeviceType::CPU) {
+        host_frame.resize(frame_size);
+        memcpy_buffer(host_frame.data(), CPU_DEVICE, frame, buffer_handle,
+                      frame_size);
+        frame = host_frame.data();
+      }
+      evicted_bytes += cache.put(keys[start + i], frame, frame_size);
+    }
+    n = run_end;
+  }
+  return evicted_bytes;
+}
+
+// Shape to decode the frames of a video column to. Frames are only converted
+// if every op reading the column asks for the same shape.
+FrameInfo decoded_frame_info(const std::vector<FrameFormatRequest>& requests,
+                             const FrameInfo& video) {
+  if (requests.empty()) {
+    return video;
+  }
+  FrameInfo info;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    if (!requests[i].format) {
+      return video;
+    }
+    FrameInfo requested = requests[i].format(requests[i].args, video);
+    if (i > 0 && requested != info) {
+      return video;
+    }
+    info = requested;
+  }
+  if (info.type != FrameType::U8 || info.width() <= 0 ||
+      info.height() <= 0 || (info.channels() != 1 && info.channels() != 3)) {
+    LOG(WARNING) << "Ignoring unsupported frame format " << info.height()
+                 << "x" << info.width() << "x" << info.channels();
+    return video;
+  }
+  return info;
+}
+
+// Keeps only the selected rows of each column, deleting the others
+void select_rows(BatchedColumns& columns,
+                 const std::vector<DeviceHandle>& handles,
+                 const std::vector<i32>& rows) {
+  for (size_t c = 0; c < columns.size(); ++c) {
+    ElementList& column = columns[c];
+    ElementList selected;
+    selected.reserve(rows.size());
+    size_t next = 0;
+    for (size_t r = 0; r < column.size(); ++r) {
+      if (next < rows.size() && rows[next] == (i32)r) {
+        selected.push_back(column[r]);
+        next++;
+      } else {
+        delete_element(handles[c], column[r]);
+      }
+    }
+    column.swap(selected);
+  }
+}
+
+// Frames of the GOP before the first requested frame of args which the
+// decoder has to decode anyway, since later frames refer to them
+i64 redundant_frames(const proto::DecodeArgs& args) {
+  if (args.keyframes_only() || args.valid_frames_size() == 0) {
+    return 0;
+  }
+  i64 frames = args.valid_frames(0) - args.start_keyframe();
+  if (args.reference_frames_size() == 0) {
+    return frames;
+  }
+  i64 count = 0;
+  for (i64 i = 0; i < frames && i < args.reference_frames_size(); ++i) {
+    count += args.reference_frames(i) ? 1 : 0;
+  }
+  return count;
+}
+}
 
 void* pre_evaluate_thread(void* arg) {
   PreEvaluateThreadArgs& args = *reinterpret_cast<PreEvaluateThreadArgs*>(arg);
@@ -20,9 +127,10 @@ void* pre_evaluate_thread(void* arg) {
   i32 last_table_id = -1;
   i32 last_end_row = -1;
   i32 last_item_id = -1;
+  std::vector<SampleSpan> last_sample_spans;
 
   DeviceHandle decoder_output_handle;
-  std::vector<std::unique_ptr<DecoderAutomata>> decoders;
+  std::vector<std::unique_ptr<GopDecoderPool>> decoders;
   while (true) {
     auto idle_start = now();
     // Wait for next work item to process
@@ -43,18 +151,53 @@ void* pre_evaluate_thread(void* arg) {
     auto work_start = now();
 
     bool needs_configure = !(io_item.table_id() == last_table_id);
-    bool needs_reset = true;
-    // NOTE(apoms): for avoiding warmup
-    // needs_configure || !(io_item.item_id() == last_item_id ||
-    //       (io_item.table_id() == last_table_id &&
-    //        io_item.start_element() == last_end_element));
+    // An io item whose input rows pick up where those of the previous one
+    // on this pipeline ended keeps the state of the kernels. They have
+    // already seen its warmup rows, so those are dropped instead of decoded
+    // and evaluated again. Contiguous output rows are not enough, as strided
+    // and gathered samples jump around their input. Rows missing from sparse
+    // entries make the warmup rows ambiguous.
+    bool continues_previous =
+        !needs_configure && !work_entry.sparse_rows &&
+        io_item.start_row() == last_end_row &&
+        continues_samples(last_sample_spans, work_entry.sample_spans);
+    bool needs_reset = !continues_previous;
+    i64 skipped_warmup_rows = continues_previous ? work_entry.warmup_rows : 0;
 
     last_table_id = io_item.table_id();
     last_end_row = io_item.end_row();
     last_item_id = io_item.item_id();
-
-    // Split up a work entry into work item size chunks
-    i64 total_rows = io_item.end_row() - io_item.start_row();
+    last_sample_spans = work_entry.sample_spans;
+
+    // Split up a work entry into work item size chunks. Warmup rows come
+    // before the rows of the io item.
+    i64 total_rows = work_entry.sparse_rows
+                         ? static_cast<i64>(work_entry.row_ids.size())
+                         : io_item.end_row() - io_item.start_row() +
+                               work_entry.warmup_rows;
+    if (skipped_warmup_rows > 0) {
+      i32 media_idx = 0;
+      for (size_t c = 0; c < work_entry.columns.size(); ++c) {
+        bool is_video = work_entry.column_types[c] == ColumnType::Video;
+        bool encoded = is_video && work_entry.video_encoding_type[media_idx] ==
+                                       proto::VideoDescriptor::H264;
+        if (is_video) {
+          media_idx++;
+        }
+        if (encoded) {
+          // Dropped from the decode args below
+          continue;
+        }
+        ElementList& column = work_entry.columns[c];
+        for (i64 r = 0; r < skipped_warmup_rows; ++r) {
+          delete_element(work_entry.column_handles[c], column[r]);
+        }
+        column.erase(column.begin(), column.begin() + skipped_warmup_rows);
+      }
+      total_rows -= skipped_warmup_rows;
+      work_entry.warmup_rows = 0;
+      args.profiler.increment("warmup_rows_skipped", skipped_warmup_rows);
+    }
 
     if (needs_configure) {
       // decoders.clear();
@@ -76,12 +219,14 @@ void* pre_evaluate_thread(void* arg) {
       } else {
         decoder_output_handle = CPU_DEVICE;
         decoder_type = VideoDecoderType::SOFTWARE;
-        num_devices = args.num_cpus;
+        // Threads of each software decoder context
+        num_devices = args.codec_budget->context_threads();
       }
       for (size_t c = 0; c < work_entry.columns.size(); ++c) {
         if (work_entry.column_types[c] == ColumnType::Video) {
-          decoders.emplace_back(new DecoderAutomata(args.device_handle,
-                                                    num_devices, decoder_type));
+          decoders.emplace_back(new GopDecoderPool(args.device_handle,
+                                                   num_devices, decoder_type,
+                                                   args.gop_decoders));
           decoders.back()->set_profiler(&args.profiler);
         }
       }
@@ -90,6 +235,14 @@ void* pre_evaluate_thread(void* arg) {
 
     i32 media_col_idx = 0;
     std::vector<std::vector<proto::DecodeArgs>> decode_args;
+    std::vector<FrameInfo> decode_frame_info;
+    // Cached frame for each row of each decoded column, or null if the row
+    // must be decoded, along with the cache key for every row
+    std::vector<std::vector<FrameCache::FrameData>> cached_frames;
+    std::vector<std::vector<FrameCacheKey>> frame_keys;
+    i64 cache_hits = 0;
+    i64 cache_misses = 0;
+    i64 cache_evicted_bytes = 0;
     bool first_item = true;
     std::vector<EvalWorkEntry> work_items;
     auto setup_start = now();
@@ -98,10 +251,13 @@ void* pre_evaluate_thread(void* arg) {
           work_entry.video_encoding_type[media_col_idx] ==
               proto::VideoDescriptor::H264) {
         decode_args.emplace_back();
-        auto& args = decode_args.back();
+        cached_frames.emplace_back();
+        frame_keys.emplace_back();
+        auto& column_args = decode_args.back();
+        i64 frames_to_skip = skipped_warmup_rows;
         for (Element element : work_entry.columns[c]) {
-          args.emplace_back();
-          proto::DecodeArgs& da = args.back();
+          column_args.emplace_back();
+          proto::DecodeArgs& da = column_args.back();
           google::protobuf::io::ArrayInputStream in_stream(element.buffer,
                                                            element.size);
           google::protobuf::io::CodedInputStream cstream(&in_stream);
@@ -109,15 +265,80 @@ void* pre_evaluate_thread(void* arg) {
           bool result = da.ParseFromCodedStream(&cstream);
           assert(result);
           delete_element(CPU_DEVICE, element);
+          if (decode_frame_info.size() < decode_args.size()) {
+            FrameInfo info(da.height(), da.width(), 3, FrameType::U8);
+            if (decoders[media_col_idx]->can_convert_frames() &&
+                c < args.frame_formats.size()) {
+              info = decoded_frame_info(args.frame_formats[c], info);
+            }
+            decode_frame_info.push_back(info);
+          }
+          if (frames_to_skip > 0) {
+            i64 skip = std::min(frames_to_skip, (i64)da.valid_frames_size());
+            frames_to_skip -= skip;
+            if (skip == da.valid_frames_size()) {
+              delete_buffer(CPU_DEVICE, (u8*)da.encoded_video());
+              column_args.pop_back();
+              continue;
+            }
+            da.mutable_valid_frames()->erase(
+                da.mutable_valid_frames()->begin(),
+                da.mutable_valid_frames()->begin() + skip);
+          }
+          if (column_args.size() == 1) {
+            // Frames decoded only to reach the first requested frame of the
+            // io item. These are decoded again when an io item boundary
+            // falls inside a GOP.
+            args.profiler.increment("frames_redundant",
+                                    redundant_frames(column_args[0]));
+          }
+          if (args.frame_cache == nullptr) {
+            continue;
+          }
+          // Only ask the decoder for the frames which are not cached
+          std::vector<i64> uncached_frames;
+          for (i64 frame : da.valid_frames()) {
+            const FrameInfo& info = decode_frame_info.back();
+            FrameCacheKey key{da.table_id(), da.column_id(),
+                              da.item_start_row() + frame, info.width(),
+                              info.height(), info.channels()};
+            FrameCache::FrameData data = args.frame_cache->get(key);
+            if (data) {
+              cache_hits++;
+            } else {
+              cache_misses++;
+              uncached_frames.push_back(frame);
+            }
+            cached_frames.back().push_back(std::move(data));
+            frame_keys.back().push_back(key);
+          }
+          if (uncached_frames.empty()) {
+            delete_buffer(CPU_DEVICE, (u8*)da.encoded_video());
+            column_args.pop_back();
+          } else if (uncached_frames.size() <
+                     static_cast<size_t>(da.valid_frames_size())) {
+            da.clear_valid_frames();
+            for (i64 frame : uncached_frames) {
+              da.add_valid_frames(frame);
+            }
+          }
+        }
+        if (!column_args.empty()) {
+          decoders[media_col_idx]->initialize(column_args,
+                                              decode_frame_info.back());
+        }
+        if (decode_frame_info.size() < decode_args.size()) {
+          decode_frame_info.push_back(work_entry.frame_sizes[media_col_idx]);
         }
-        decoders[media_col_idx]->initialize(args);
         media_col_idx++;
       }
     }
     args.profiler.add_interval("setup", setup_start, now());
 
     auto decode_start = now();
-    for (i64 r = 0; r < total_rows; r += work_item_size) {
+    // An io item whose rows are all missing from a sparse input table is
+    // still passed on as a single empty entry so its output item is written
+    for (i64 r = 0; r < std::max(total_rows, (i64)1); r += work_item_size) {
       media_col_idx = 0;
       EvalWorkEntry entry;
       entry.io_item_index = work_entry.io_item_index;
@@ -126,21 +347,39 @@ void* pre_evaluate_thread(void* arg) {
       entry.last_in_io_item = (r + work_item_size >= total_rows) ? true : false;
       entry.warmup_rows = work_entry.warmup_rows;
       entry.columns.resize(work_entry.columns.size());
+      i64 start = r;
+      i64 end = std::min(r + work_item_size, total_rows);
+      reserve_rows(entry.columns, end - start);
+      std::vector<size_t> entry_capacities = column_capacities(entry.columns);
+      entry.sparse_rows = work_entry.sparse_rows;
+      for (i64 i = start; i < end; ++i) {
+        entry.row_ids.push_back(work_entry.sparse_rows ? work_entry.row_ids[i]
+                                                       : i);
+      }
       for (size_t c = 0; c < work_entry.columns.size(); ++c) {
-        i64 start = r;
-        i64 end = std::min(r + work_item_size, total_rows);
         if (work_entry.column_types[c] == ColumnType::Video) {
           // Perform decoding
           i64 num_rows = end - start;
-          if (work_entry.video_encoding_type[media_col_idx] ==
-              proto::VideoDescriptor::H264) {
+          if (num_rows == 0) {
+            // Every row of the io item is missing
+            entry.column_handles.push_back(work_entry.column_handles[c]);
+          } else if (work_entry.video_encoding_type[media_col_idx] ==
+                     proto::VideoDescriptor::H264) {
             // Encoded as video
-            FrameInfo frame_info(decode_args[media_col_idx][0].height(),
-                                 decode_args[media_col_idx][0].width(), 3,
-                                 FrameType::U8);
+            const FrameInfo& frame_info = decode_frame_info[media_col_idx];
             u8* buffer = new_block_buffer(
                 decoder_output_handle, num_rows * frame_info.size(), num_rows);
-            decoders[media_col_idx]->get_frames(buffer, num_rows);
+            args.profiler.increment("decoded_frame_bytes",
+                                    num_rows * frame_info.size());
+            if (args.frame_cache == nullptr) {
+              decoders[media_col_idx]->get_frames(buffer, num_rows);
+            } else {
+              cache_evicted_bytes += get_frames_through_cache(
+                  *args.frame_cache, decoders[media_col_idx].get(),
+                  decoder_output_handle, frame_info.size(),
+                  cached_frames[media_col_idx], frame_keys[media_col_idx],
+                  start, num_rows, buffer);
+            }
             for (i64 n = 0; n < num_rows; ++n) {
               insert_frame(
                   entry.columns[c],
@@ -158,20 +397,33 @@ void* pre_evaluate_thread(void* arg) {
             entry.column_handles.push_back(work_entry.column_handles[c]);
           }
           media_col_idx++;
+        } else if (start == 0 && end == (i64)work_entry.columns[c].size()) {
+          // Whole column fits in one work item so hand it over as is
+          entry.columns[c] = std::move(work_entry.columns[c]);
+          entry_capacities[c] = entry.columns[c].capacity();
+          entry.column_handles.push_back(work_entry.column_handles[c]);
         } else {
-          entry.columns[c] =
-              std::vector<Element>(work_entry.columns[c].begin() + start,
-                                   work_entry.columns[c].begin() + end);
+          entry.columns[c].assign(work_entry.columns[c].begin() + start,
+                                  work_entry.columns[c].begin() + end);
           entry.column_handles.push_back(work_entry.column_handles[c]);
         }
       }
+      args.profiler.increment("reallocations",
+                              count_reallocations(entry.columns,
+                                                  entry_capacities));
       // Push entry to kernels
       auto queue_start = now();
-      args.output_work.push(std::make_tuple(io_item, entry));
+      args.output_work.push(std::make_tuple(io_item, std::move(entry)));
       first_item = false;
       args.profiler.add_interval("queue", queue_start, now());
     }
     args.profiler.add_interval("decode", decode_start, now());
+    if (args.frame_cache != nullptr) {
+      args.profiler.increment("frame_cache_hits", cache_hits);
+      args.profiler.increment("frame_cache_misses", cache_misses);
+      args.profiler.increment("frame_cache_evicted_bytes",
+                              cache_evicted_bytes);
+    }
   }
 
   VLOG(1) << "Pre-evaluate (N/PU: " << args.node_id << "/" << args.id
@@ -190,16 +442,17 @@ void* evaluate_thread(void* arg) {
   const std::vector<std::vector<i32>>& column_mapping = args.column_mapping;
   std::vector<DeviceHandle> kernel_devices;
   std::vector<i32> kernel_num_outputs;
+  std::vector<bool> kernel_can_filter;
   std::vector<std::unique_ptr<Kernel>> kernels;
   {
     OpRegistry* registry = get_op_registry();
     for (size_t i = 0; i < args.kernel_factories.size(); ++i) {
       KernelFactory* factory = std::get<0>(args.kernel_factories[i]);
       const Kernel::Config& config = std::get<1>(args.kernel_factories[i]);
+      OpInfo* op_info = registry->get_op_info(factory->get_op_name());
       kernel_devices.push_back(config.devices[0]);
-      kernel_num_outputs.push_back(registry->get_op_info(factory->get_op_name())
-                                       ->output_columns()
-                                       .size());
+      kernel_num_outputs.push_back(op_info->output_columns().size());
+      kernel_can_filter.push_back(op_info->can_filter());
 
 #ifdef HAVE_CUDA
       cudaSetDevice(0);
@@ -253,8 +506,12 @@ void* evaluate_thread(void* arg) {
     output_work_entry.needs_reset = work_entry.needs_reset;
     output_work_entry.last_in_io_item = work_entry.last_in_io_item;
     output_work_entry.warmup_rows = work_entry.warmup_rows;
+    // Only entries which actually lost rows to a filter become sparse
+    output_work_entry.sparse_rows = work_entry.sparse_rows;
 
     BatchedColumns& work_item_output_columns = output_work_entry.columns;
+    // Capacity of each output column after reserving for the whole entry
+    std::vector<size_t> work_item_output_capacities;
     std::vector<DeviceHandle>& work_item_output_handles =
         output_work_entry.column_handles;
     i32 num_final_output_columns = 0;
@@ -265,9 +522,19 @@ void* evaluate_thread(void* arg) {
       total_inputs =  // io_item.end_row - io_item.start_row;
           std::max(total_inputs, (i32)work_entry.columns[i].size());
     }
-    while (current_input < total_inputs) {
+    assert(work_entry.row_ids.size() == total_inputs);
+    // Entries with no rows left still pass through once so that the
+    // columns of their output are set up
+    bool first_batch = true;
+    while (first_batch || current_input < total_inputs) {
+      first_batch = false;
       i32 batch_size = std::min(total_inputs - current_input,
                                 args.job_params->work_item_size());
+      // Rows still alive in the batch, which filtering ops narrow down
+      i32 live_rows = batch_size;
+      std::vector<i64> batch_row_ids(
+          work_entry.row_ids.begin() + current_input,
+          work_entry.row_ids.begin() + current_input + batch_size);
 
       BatchedColumns side_input_columns;
       DeviceHandle input_handle;
@@ -279,11 +546,15 @@ void* evaluate_thread(void* arg) {
       side_output_columns.resize(work_entry.columns.size());
       for (size_t i = 0; i < work_entry.columns.size(); ++i) {
         i32 batch = std::min(batch_size, (i32)work_entry.columns[i].size());
-        assert(batch > 0);
-        side_output_columns[i].insert(
-            side_output_columns[i].end(),
-            work_entry.columns[i].begin() + current_input,
-            work_entry.columns[i].begin() + current_input + batch);
+        assert(batch > 0 || total_inputs == 0);
+        if (batch == total_inputs) {
+          // Single batch so take ownership of the input column
+          side_output_columns[i] = std::move(work_entry.columns[i]);
+        } else {
+          side_output_columns[i].assign(
+              work_entry.columns[i].begin() + current_input,
+              work_entry.columns[i].begin() + current_input + batch);
+        }
       }
       for (size_t k = 0; k < kernels.size(); ++k) {
         const std::string& op_name =
@@ -293,8 +564,10 @@ void* evaluate_thread(void* arg) {
         i32 num_outputs = kernel_num_outputs[k];
 
         // Map from previous output columns to the set of input columns needed
-        // by the kernel
+        // by the kernel. Columns are lent to the kernel and moved back after
+        // it executes.
         BatchedColumns input_columns;
+        std::vector<bool> input_lent;
         for (i32 in_col_idx : column_mapping[k]) {
           assert(in_col_idx < side_output_columns.size());
 
@@ -310,17 +583,65 @@ void* evaluate_thread(void* arg) {
           input_handle = current_handle;
           args.profiler.add_interval("op_marshal", copy_start, now());
 
-          input_columns.push_back(side_output_columns[in_col_idx]);
+          bool lent = std::count(column_mapping[k].begin(),
+                                 column_mapping[k].end(), in_col_idx) == 1;
+          if (lent) {
+            input_columns.push_back(std::move(side_output_columns[in_col_idx]));
+          } else {
+            input_columns.push_back(side_output_columns[in_col_idx]);
+          }
+          input_lent.push_back(lent);
         }
 
         // Setup output buffers to receive op output
         DeviceHandle output_handle = current_handle;
         BatchedColumns output_columns;
         output_columns.resize(num_outputs);
-
-        auto eval_start = now();
-        kernel->execute(input_columns, output_columns);
-        args.profiler.add_interval("evaluate:" + op_name, eval_start, now());
+        reserve_rows(output_columns, live_rows);
+        std::vector<size_t> output_capacities =
+            column_capacities(output_columns);
+
+        // Kernels are not run once every row has been filtered out
+        if (live_rows > 0) {
+          auto eval_start = now();
+          kernel->execute(input_columns, output_columns);
+          args.profiler.add_interval("evaluate:" + op_name, eval_start, now());
+          args.profiler.increment(
+              "reallocations",
+              count_reallocations(output_columns, output_capacities));
+        }
+        for (size_t i = 0; i < input_columns.size(); ++i) {
+          if (input_lent[i]) {
+            side_output_columns[column_mapping[k][i]] =
+                std::move(input_columns[i]);
+          }
+        }
+        // Drop the rows a filtering op did not select from every column
+        std::vector<i32> selected_rows;
+        if (kernel->take_selected_rows(selected_rows)) {
+          LOG_IF(FATAL, !kernel_can_filter[k])
+              << "Op " << op_name << " selected rows but was not registered "
+              << "as a filter";
+          for (size_t i = 0; i < selected_rows.size(); ++i) {
+            i32 prev_row = i > 0 ? selected_rows[i - 1] : -1;
+            LOG_IF(FATAL, selected_rows[i] <= prev_row ||
+                              selected_rows[i] >= live_rows)
+                << "Op " << op_name << " selected invalid row "
+                << selected_rows[i];
+          }
+          select_rows(side_output_columns, side_output_handles, selected_rows);
+          std::vector<i64> selected_row_ids;
+          for (i32 r : selected_rows) {
+            selected_row_ids.push_back(batch_row_ids[r]);
+          }
+          batch_row_ids.swap(selected_row_ids);
+          args.profiler.increment("rows_filtered",
+                                  live_rows - (i64)selected_rows.size());
+          if ((i32)selected_rows.size() < live_rows) {
+            output_work_entry.sparse_rows = true;
+          }
+          live_rows = selected_rows.size();
+        }
         // Delete unused outputs
         for (size_t y = 0; y < unused_outputs[k].size(); ++y) {
           i32 unused_col_idx =
@@ -333,10 +654,10 @@ void* evaluate_thread(void* arg) {
         }
         // Verify the kernel produced the correct amount of output
         for (size_t i = 0; i < output_columns.size(); ++i) {
-          LOG_IF(FATAL, output_columns[i].size() != batch_size)
+          LOG_IF(FATAL, output_columns[i].size() != live_rows)
               << "Op " << k << " produced " << output_columns[i].size()
               << " output elements for column " << i << ". Expected "
-              << batch_size << " outputs.";
+              << live_rows << " outputs.";
         }
         // Delete dead columns
         for (size_t y = 0; y < dead_columns[k].size(); ++y) {
@@ -349,33 +670,47 @@ void* evaluate_thread(void* arg) {
           side_output_handles.erase(side_output_handles.begin() + dead_col_idx);
         }
         // Add new output columns
-        for (const ElementList& column : output_columns) {
-          side_output_columns.push_back(column);
+        for (ElementList& column : output_columns) {
+          side_output_columns.push_back(std::move(column));
           side_output_handles.push_back(current_handle);
         }
       }
       if (work_item_output_columns.size() == 0) {
         num_final_output_columns = side_output_columns.size();
         work_item_output_columns.resize(side_output_columns.size());
+        work_item_output_capacities.resize(side_output_columns.size());
         work_item_output_handles = side_output_handles;
       }
       assert(num_final_output_columns == side_output_columns.size());
       for (i32 i = 0; i < num_final_output_columns; ++i) {
-        i32 num_output_elements =
-            static_cast<i32>(side_output_columns[i].size());
-        work_item_output_columns[i].insert(work_item_output_columns[i].end(),
-                                           side_output_columns[i].begin(),
-                                           side_output_columns[i].end());
+        if (work_item_output_columns[i].empty()) {
+          work_item_output_columns[i].swap(side_output_columns[i]);
+          work_item_output_columns[i].reserve(total_inputs);
+          work_item_output_capacities[i] =
+              work_item_output_columns[i].capacity();
+        } else {
+          work_item_output_columns[i].insert(work_item_output_columns[i].end(),
+                                             side_output_columns[i].begin(),
+                                             side_output_columns[i].end());
+        }
       }
+      output_work_entry.row_ids.insert(output_work_entry.row_ids.end(),
+                                       batch_row_ids.begin(),
+                                       batch_row_ids.end());
       current_input += batch_size;
     }
 
     args.profiler.add_interval("task", work_start, now());
+    args.profiler.increment(
+        "reallocations",
+        count_reallocations(work_item_output_columns,
+                            work_item_output_capacities));
 
     VLOG(2) << "Evaluate (N/KI/G: " << args.node_id << "/" << args.ki << "/"
             << args.kg << "): finished item " << work_entry.io_item_index;
 
-    args.output_work.push(std::make_tuple(io_item, output_work_entry));
+    args.output_work.push(
+        std::make_tuple(io_item, std::move(output_work_entry)));
   }
 
   VLOG(1) << "Evaluate (N/KI: " << args.node_id << "/" << args.ki
@@ -426,6 +761,7 @@ void* post_evaluate_thread(void* arg) {
   }
 
   EvalWorkEntry buffered_entry;
+  std::vector<size_t> buffered_capacities;
   i64 current_offset = 0;
   while (true) {
     auto idle_start = now();
@@ -450,14 +786,23 @@ void* post_evaluate_thread(void* arg) {
     if (buffered_entry.columns.size() == 0) {
       buffered_entry.io_item_index = work_entry.io_item_index;
       buffered_entry.columns.resize(args.column_mapping.size());
+      reserve_rows(buffered_entry.columns,
+                   io_item.end_row() - io_item.start_row());
+      buffered_capacities = column_capacities(buffered_entry.columns);
       assert(work_entry.column_handles.size() == args.columns.size());
       for (size_t i = 0; i < args.columns.size(); ++i) {
         buffered_entry.column_types.push_back(args.columns[i].type());
         buffered_entry.column_handles.push_back(work_entry.column_handles[i]);
         if (args.columns[i].type() == ColumnType::Video) {
-          assert(work_entry.columns[i].size() > 0);
-          Frame* frame = work_entry.columns[i][0].as_frame();
-          buffered_entry.frame_sizes.push_back(frame->as_frame_info());
+          // Filtered entries may hold no frames, in which case the frame
+          // size is filled in from the first entry that does
+          if (work_entry.columns[i].size() > 0) {
+            Frame* frame = work_entry.columns[i][0].as_frame();
+            buffered_entry.frame_sizes.push_back(frame->as_frame_info());
+          } else {
+            buffered_entry.frame_sizes.push_back(
+                FrameInfo(0, 0, 0, FrameType::U8));
+          }
         }
         buffered_entry.compressed.push_back(compression_enabled[i]);
       }
@@ -468,8 +813,19 @@ void* post_evaluate_thread(void* arg) {
       }
     }
 
+    // The io item is sparse if any of its work items lost rows
+    buffered_entry.sparse_rows |= work_entry.sparse_rows;
     i64 num_rows = work_entry.columns[0].size();
-    i32 warmup_frames = work_entry.warmup_rows;
+    // Only the chunks at the start of an io item hold its warmup rows, and
+    // only those that survived filtering are left to delete
+    i32 warmup_frames = 0;
+    for (i64 id : work_entry.row_ids) {
+      if (id < work_entry.warmup_rows) {
+        warmup_frames++;
+      } else {
+        buffered_entry.row_ids.push_back(id - work_entry.warmup_rows);
+      }
+    }
     current_offset += num_rows;
 
     i32 encoder_idx = 0;
@@ -491,10 +847,14 @@ void* post_evaluate_thread(void* arg) {
           work_entry.columns[col_idx].erase(start, warmup_end);
         }
         auto& encoder = encoders[encoder_idx];
-        if (!encoder_configured[encoder_idx]) {
+        if (!encoder_configured[encoder_idx] &&
+            !work_entry.columns[col_idx].empty()) {
           // Configure encoder
           encoder_configured[encoder_idx] = true;
           Frame* frame = work_entry.columns[col_idx][0].as_frame();
+          buffered_entry.frame_sizes[encoder_idx] = frame->as_frame_info();
+          encode_options[encoder_idx].thread_count =
+              args.codec_budget->context_threads();
           encoder->configure(frame->as_frame_info(),
                              encode_options[encoder_idx]);
         }
@@ -506,6 +866,7 @@ void* post_evaluate_thread(void* arg) {
 
         // Pass frames into encoder
         auto encode_start = now();
+        i64 encode_cpu_start = cpu_nanos();
         for (auto& row : work_entry.columns[col_idx]) {
           Frame* frame = row.as_frame();
           bool new_packet = encoder->feed(frame->data, frame->size());
@@ -521,6 +882,10 @@ void* post_evaluate_thread(void* arg) {
           }
         }
         args.profiler.add_interval("encode", work_start, now());
+        args.profiler.increment("encode_thread_cpu_ns",
+                                cpu_nanos() - encode_cpu_start);
+        args.profiler.increment("frames_encoded",
+                                work_entry.columns[col_idx].size());
         encoder_idx++;
       } else {
         // Keep non-warmup frame outputs
@@ -552,7 +917,10 @@ void* post_evaluate_thread(void* arg) {
 
           // Get last packets in encoder
           auto encode_flush_start = now();
-          bool new_packet = encoder->flush();
+          i64 encode_cpu_start = cpu_nanos();
+          // Encoders never fed a frame have nothing to flush
+          bool new_packet =
+              encoder_configured[encoder_idx] ? encoder->flush() : false;
           while (new_packet) {
             size_t buffer_size = 4 * 1024 * 1024;
             u8* buffer = new_buffer(CPU_DEVICE, buffer_size);
@@ -566,13 +934,19 @@ void* post_evaluate_thread(void* arg) {
             insert_element(buffered_entry.columns[i], buffer, actual_size);
           }
           args.profiler.add_interval("encode_flush", encode_flush_start, now());
+          args.profiler.increment("encode_thread_cpu_ns",
+                                  cpu_nanos() - encode_cpu_start);
           encoder_configured[encoder_idx] = false;
           encoder_idx++;
         }
       }
 
-      args.output_work.push(std::make_tuple(io_item, buffered_entry));
-      buffered_entry.columns.clear();
+      args.profiler.increment(
+          "reallocations",
+          count_reallocations(buffered_entry.columns, buffered_capacities));
+      args.output_work.push(
+          std::make_tuple(io_item, std::move(buffered_entry)));
+      buffered_entry = EvalWorkEntry();
     }
 
     args.profiler.add_interval("task", work_start, now());
@@ -15,6 +15,8 @@
 
 #pragma once
 
+#include "scanner/engine/codec_thread_budget.h"
+#include "scanner/engine/frame_cache.h"
 #include "scanner/engine/kernel_factory.h"
 #include "scanner/engine/runtime.h"
 #include "scanner/util/common.h"
@@ -28,18 +30,33 @@ void move_if_different_address_space(Profiler& profiler,
                                      DeviceHandle target_handle,
                                      BatchedColumns& columns);
 
+// An op reading a column straight from the input table
+struct FrameFormatRequest {
+  // Shape the op wants frames decoded to, or null for full resolution RGB
+  FrameFormatFn format;
+  std::vector<u8> args;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Worker thread arguments
 struct PreEvaluateThreadArgs {
   // Uniform arguments
   i32 node_id;
   i32 num_cpus;
+  // Decoders sharing the GOPs of each video column of an io item
+  i32 gop_decoders;
   const proto::JobParameters* job_params;
 
   // Per worker arguments
   i32 id;
   DeviceHandle device_handle;
   Profiler& profiler;
+  // Shared by all pipeline instances on the node, null if disabled
+  FrameCache* frame_cache;
+  // Sizes the threads of the decoders, shared by all pipeline instances
+  CodecThreadBudget* codec_budget;
+  // The ops reading each column of the input table
+  std::vector<std::vector<FrameFormatRequest>> frame_formats;
 
   // Queues for communicating work
   Queue<std::tuple<IOItem, EvalWorkEntry>>& input_work;
@@ -86,6 +103,8 @@ struct PostEvaluateThreadArgs {
   std::vector<i32> column_mapping;
   std::vector<Column> columns;
   std::vector<ColumnCompressionOptions> column_compression;
+  // Sizes the threads of the encoders, shared by all pipeline instances
+  CodecThreadBudget* codec_budget;
 
   // Queues for communicating work
   Queue<std::tuple<IOItem, EvalWorkEntry>>& input_work;
@@ -0,0 +1,71 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/frame_cache.h"
+
+namespace scanner {
+namespace internal {
+
+FrameCache::FrameCache(size_t capacity_bytes)
+  : capacity_(capacity_bytes), size_(0) {}
+
+FrameCache::FrameData FrameCache::get(const FrameCacheKey& key) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+size_t FrameCache::put(const FrameCacheKey& key, const u8* buffer,
+                       size_t size) {
+  if (size > capacity_) {
+    return 0;
+  }
+  // Copy outside of the lock since frames are large
+  auto data = std::make_shared<std::vector<u8>>(buffer, buffer + size);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    // Another pipeline instance decoded the same frame concurrently
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return 0;
+  }
+
+  size_t evicted = 0;
+  while (size_ + size > capacity_) {
+    const Entry& victim = lru_.back();
+    size_t victim_size = victim.second->size();
+    entries_.erase(victim.first);
+    lru_.pop_back();
+    size_ -= victim_size;
+    evicted += victim_size;
+  }
+
+  lru_.emplace_front(key, std::move(data));
+  entries_[key] = lru_.begin();
+  size_ += size;
+  return evicted;
+}
+
+size_t FrameCache::size() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return size_;
+}
+}
+}
@@ -0,0 +1,94 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+struct FrameCacheKey {
+  i32 table_id;
+  i32 column_id;
+  i64 row;
+  // Frames may be decoded to a smaller size or to gray for some jobs
+  i32 width;
+  i32 height;
+  i32 channels;
+
+  bool operator==(const FrameCacheKey& other) const {
+    return table_id == other.table_id && column_id == other.column_id &&
+           row == other.row && width == other.width &&
+           height == other.height && channels == other.channels;
+  }
+};
+
+struct FrameCacheKeyHash {
+  size_t operator()(const FrameCacheKey& key) const {
+    size_t h = std::hash<i64>()(key.row);
+    h ^= std::hash<i32>()(key.table_id) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= std::hash<i32>()(key.column_id) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= std::hash<i32>()(key.width * 4 + key.channels) + 0x9e3779b9 +
+         (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
+/// Node-wide LRU cache of decoded video frames held in host memory.
+///
+/// A single instance is owned by the worker and shared by every pipeline
+/// instance across jobs, so overlapping jobs over the same table only pay
+/// for decoding a frame once. Table ids are never reused by the database,
+/// which makes (table, column, row) along with the decoded frame shape a
+/// stable key for the frame contents.
+class FrameCache {
+ public:
+  using FrameData = std::shared_ptr<const std::vector<u8>>;
+
+  FrameCache(size_t capacity_bytes);
+
+  // Returns the cached frame or nullptr on a miss. The returned data stays
+  // valid even if the entry is evicted while the caller still holds it.
+  FrameData get(const FrameCacheKey& key);
+
+  // Copies size bytes from buffer into the cache, evicting least recently
+  // used frames to stay under capacity. Returns the number of bytes evicted.
+  size_t put(const FrameCacheKey& key, const u8* buffer, size_t size);
+
+  size_t capacity() const { return capacity_; }
+
+  size_t size() const;
+
+ private:
+  using Entry = std::pair<FrameCacheKey, FrameData>;
+
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  size_t size_;
+  // Most recently used entries are kept at the front
+  std::list<Entry> lru_;
+  std::unordered_map<FrameCacheKey, std::list<Entry>::iterator,
+                     FrameCacheKeyHash>
+      entries_;
+};
+}
+}
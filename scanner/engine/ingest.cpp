@@ -25,6 +25,9 @@
 #include "storehouse/storage_backend.h"
 
 #include <glog/logging.h>
+#include <atomic>
+#include <functional>
+#include <numeric>
 #include <thread>
 
 // For video
@@ -407,6 +410,9 @@ bool parse_and_write_video(storehouse::StorageBackend* storage,
   for (i64 v : keyframe_byte_offsets) {
     video_descriptor.add_keyframe_byte_offsets(v);
   }
+  for (bool v : index_creator.reference_frames()) {
+    video_descriptor.add_reference_frames(v);
+  }
 
   // Save our metadata for the frame column
   write_video_metadata(storage, video_meta);
@@ -736,6 +742,7 @@ Result ingest_videos(storehouse::StorageConfig* storage_config,
                      const std::string& db_path,
                      const std::vector<std::string>& table_names,
                      const std::vector<std::string>& paths,
+                     i32 num_threads,
                      std::vector<FailedVideo>& failed_videos) {
   Result result;
   result.set_success(true);
@@ -768,32 +775,78 @@ Result ingest_videos(storehouse::StorageConfig* storage_config,
   if (!result.success()) {
     return result;
   }
-  std::vector<bool> bad_videos(table_names.size(), false);
-  std::vector<std::string> bad_messages(table_names.size());
-  std::vector<std::thread> ingest_threads;
-  i32 num_threads = std::thread::hardware_concurrency();
-  i32 videos_allocated = 0;
-  for (i32 t = 0; t < num_threads; ++t) {
-    i32 to_allocate =
-        (table_names.size() - videos_allocated) / (num_threads - t);
-    i32 start = videos_allocated;
-    videos_allocated += to_allocate;
-    videos_allocated = std::min((size_t)videos_allocated, table_names.size());
-    i32 end = videos_allocated;
-    ingest_threads.emplace_back([&, start, end]() {
-      for (i32 i = start; i < end; ++i) {
-        if (!internal::parse_and_write_video(storage.get(), table_names[i],
-                                             table_ids[i], paths[i],
-                                             bad_messages[i])) {
-          // Did not ingest correctly, skip it
-          bad_videos[i] = true;
+  // Videos are handed out from a shared queue, largest first, so that a long
+  // video is not left to start last while the other threads sit idle.
+  // Storage backends are not thread safe, so each thread opens its own.
+  if (num_threads <= 0) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  num_threads = std::max(1, std::min(num_threads, (i32)table_names.size()));
+  auto run_ingest_threads =
+      [&](std::function<void(storehouse::StorageBackend*)> work) {
+        std::vector<std::thread> ingest_threads;
+        for (i32 t = 0; t < num_threads; ++t) {
+          ingest_threads.emplace_back([&]() {
+            std::unique_ptr<storehouse::StorageBackend> thread_storage{
+                storehouse::StorageBackend::make_from_config(storage_config)};
+            work(thread_storage.get());
+          });
         }
+        for (std::thread& thread : ingest_threads) {
+          thread.join();
+        }
+      };
+
+  std::vector<u64> video_sizes(table_names.size(), 0);
+  std::atomic<size_t> next_video{0};
+  run_ingest_threads([&](storehouse::StorageBackend* thread_storage) {
+    for (size_t i = next_video++; i < table_names.size(); i = next_video++) {
+      // Videos which can not be opened fail when they are ingested
+      std::unique_ptr<RandomReadFile> file;
+      if (make_unique_random_read_file(thread_storage, paths[i], file) ==
+          StoreResult::Success) {
+        file->get_size(video_sizes[i]);
       }
-    });
-  }
-  for (i32 t = 0; t < num_threads; ++t) {
-    ingest_threads[t].join();
-  }
+    }
+  });
+  std::vector<size_t> order(table_names.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return video_sizes[a] > video_sizes[b];
+  });
+  u64 total_bytes = std::accumulate(video_sizes.begin(), video_sizes.end(),
+                                    static_cast<u64>(0));
+
+  // Written by one thread each, so not a vector<bool>
+  std::vector<u8> bad_videos(table_names.size(), false);
+  std::vector<std::string> bad_messages(table_names.size());
+  std::atomic<i64> videos_done{0};
+  std::atomic<u64> bytes_done{0};
+  auto ingest_start = now();
+  next_video = 0;
+  run_ingest_threads([&](storehouse::StorageBackend* thread_storage) {
+    for (size_t n = next_video++; n < order.size(); n = next_video++) {
+      size_t i = order[n];
+      if (!internal::parse_and_write_video(thread_storage, table_names[i],
+                                           table_ids[i], paths[i],
+                                           bad_messages[i])) {
+        // Did not ingest correctly, skip it
+        bad_videos[i] = true;
+      }
+      i64 videos = ++videos_done;
+      u64 bytes = bytes_done += video_sizes[i];
+      VLOG(1) << "Ingested " << videos << " of " << table_names.size()
+              << " videos, " << bytes / (1024 * 1024) << " of "
+              << total_bytes / (1024 * 1024) << " MB at "
+              << bytes / (1024.0 * 1024.0) / (nano_since(ingest_start) / 1e9)
+              << " MB/s";
+    }
+  });
+  f64 ingest_seconds = nano_since(ingest_start) / 1e9;
+  LOG(INFO) << "Ingested " << table_names.size() << " videos ("
+            << total_bytes / (1024 * 1024) << " MB) in " << ingest_seconds
+            << " s with " << num_threads << " threads, "
+            << total_bytes / (1024.0 * 1024.0) / ingest_seconds << " MB/s";
 
   size_t num_bad_videos = 0;
   for (size_t i = 0; i < table_names.size(); ++i) {
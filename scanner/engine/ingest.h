@@ -26,10 +26,12 @@
 namespace scanner {
 namespace internal {
 
+// Ingests videos on num_threads threads, or one per core if not positive
 Result ingest_videos(storehouse::StorageConfig* storage_config,
                      const std::string& db_path,
                      const std::vector<std::string>& table_names,
                      const std::vector<std::string>& paths,
+                     i32 num_threads,
                      std::vector<FailedVideo>& failed_videos);
 
 // void ingest_images(storehouse::StorageConfig *storage_config,
@@ -18,6 +18,9 @@
 #include "storehouse/storage_backend.h"
 
 #include <glog/logging.h>
+#include <algorithm>
+#include <deque>
+#include <numeric>
 
 using storehouse::StoreResult;
 using storehouse::WriteFile;
@@ -25,59 +28,37 @@ using storehouse::RandomReadFile;
 
 namespace scanner {
 namespace internal {
-namespace {
-
-struct RowIntervals {
-  std::vector<i32> item_ids;
-  std::vector<std::tuple<i64, i64>> item_intervals;
-  std::vector<std::vector<i64>> valid_offsets;
-};
-
-struct VideoIntervals {
-  std::vector<std::tuple<size_t, size_t>> keyframe_index_intervals;
-  std::vector<std::vector<i64>> valid_frames;
-};
 
-// Gets the list of work items for a sequence of rows in the job
 RowIntervals slice_into_row_intervals(const TableMetadata& table,
                                       const std::vector<i64>& rows) {
   RowIntervals info;
   // Analyze rows and table to determine what item ids and offsets in them to
   // sample from
-  std::vector<i64> end_rows = table.end_rows();
-  auto item_from_row = [&end_rows](i64 r) -> i32 {
-    i64 i = 0;
-    for (; i < end_rows.size(); ++i) {
-      if (r < end_rows[i]) {
-        break;
-      }
-    }
-    assert(i != end_rows.size());
-    return i;
-  };
-
-  auto offset_from_row = [&end_rows](i64 r) -> i64 {
-    i64 i = 0;
-    i64 last_end_row = 0;
-    for (; i < end_rows.size(); ++i) {
-      if (r < end_rows[i]) {
-        break;
-      }
-      last_end_row = end_rows[i];
+  const std::vector<i64>& end_rows = table.end_rows();
+  // Rows of the item that the last row fell in. Sorted rows stay within the
+  // same item for long runs, so the table is only searched on item changes.
+  i32 lookup_item = -1;
+  i64 lookup_start_row = 0;
+  i64 lookup_end_row = 0;
+  auto lookup = [&](i64 r) {
+    if (r < lookup_start_row || r >= lookup_end_row) {
+      lookup_item = table.item_for_row(r);
+      lookup_start_row = table.item_start_row(lookup_item);
+      lookup_end_row = end_rows[lookup_item];
     }
-    assert(i != end_rows.size());
-    return r - last_end_row;
   };
 
   assert(!rows.empty());
-  i32 current_item = item_from_row(rows[0]);
-  i64 item_start = offset_from_row(rows[0]);
+  lookup(rows[0]);
+  i32 current_item = lookup_item;
+  i64 item_start = rows[0] - lookup_start_row;
   i64 item_end = item_start + 1;
   i64 prev_row = -1;
   std::vector<i64> valid_offsets;
   for (i64 row : rows) {
-    i32 item = item_from_row(row);
-    i64 item_offset = offset_from_row(row);
+    lookup(row);
+    i32 item = lookup_item;
+    i64 item_offset = row - lookup_start_row;
     // We check two cases:
     //   1. if the row is in a new item, then we have found all the consecutive
     //      increasing rows that will be in this item and we should move on
@@ -111,6 +92,75 @@ RowIntervals slice_into_row_intervals(const TableMetadata& table,
   return info;
 }
 
+RowIntervals slice_into_row_intervals(const TableMetadata& table,
+                                      const std::vector<RowRange>& ranges) {
+  RowIntervals info;
+  const std::vector<i64>& end_rows = table.end_rows();
+  i64 prev_row = -1;
+  for (const RowRange& range : ranges) {
+    i64 row = range.start;
+    while (row < range.end) {
+      i32 item = table.item_for_row(row);
+      i64 item_start_row = table.item_start_row(item);
+      if (info.item_ids.empty() || info.item_ids.back() != item ||
+          row <= prev_row) {
+        info.item_ids.push_back(item);
+        info.item_intervals.push_back(
+            std::make_tuple(row - item_start_row, row - item_start_row + 1));
+        info.valid_offsets.emplace_back();
+      }
+      std::vector<i64>& valid_offsets = info.valid_offsets.back();
+      i64 item_last_row = std::min(range.end, end_rows[item]);
+      for (; row < item_last_row; row += range.stride) {
+        valid_offsets.push_back(row - item_start_row);
+        prev_row = row;
+      }
+      std::get<1>(info.item_intervals.back()) = valid_offsets.back() + 1;
+    }
+  }
+  return info;
+}
+
+namespace {
+
+struct VideoIntervals {
+  std::vector<std::tuple<size_t, size_t>> keyframe_index_intervals;
+  std::vector<std::vector<i64>> valid_frames;
+};
+
+RowRange row_range_from_proto(const proto::RowRange& range) {
+  return RowRange{range.start(), range.end(), range.stride()};
+}
+
+// Whether the warmup and rows of the sample are strided ranges instead of
+// explicit lists
+bool is_range_sample(const proto::LoadSample& sample) {
+  return sample.has_row_range();
+}
+
+i64 num_warmup_rows(const proto::LoadSample& sample) {
+  return is_range_sample(sample)
+             ? row_range_from_proto(sample.warmup_range()).size()
+             : sample.warmup_rows_size();
+}
+
+// Warmup rows followed by the rows of the sample
+std::vector<i64> sample_rows_with_warmup(const proto::LoadSample& sample) {
+  std::vector<i64> rows;
+  if (is_range_sample(sample)) {
+    for (const RowRange& range : {row_range_from_proto(sample.warmup_range()),
+                                  row_range_from_proto(sample.row_range())}) {
+      for (i64 r = range.start; r < range.end; r += range.stride) {
+        rows.push_back(r);
+      }
+    }
+  } else {
+    rows.assign(sample.warmup_rows().begin(), sample.warmup_rows().end());
+    rows.insert(rows.end(), sample.rows().begin(), sample.rows().end());
+  }
+  return rows;
+}
+
 VideoIntervals slice_into_video_intervals(
     const std::vector<i64>& keyframe_positions, const std::vector<i64>& rows) {
   VideoIntervals info;
@@ -178,13 +228,17 @@ struct VideoIndexEntry {
   FrameType frame_type;
   proto::VideoDescriptor::VideoCodecType codec_type;
   std::unique_ptr<RandomReadFile> file;
+  // Set when the database is on posix storage
+  std::unique_ptr<MappedFile> mapped_file;
   u64 file_size;
   std::vector<i64> keyframe_positions;
   std::vector<i64> keyframe_byte_offsets;
+  std::vector<bool> reference_frames;
 };
 
 VideoIndexEntry read_video_index(storehouse::StorageBackend* storage,
-                                 i32 table_id, i32 column_id, i32 item_id) {
+                                 i32 table_id, i32 column_id, i32 item_id,
+                                 bool map_file) {
   VideoIndexEntry index_entry;
   VideoMetadata video_meta = read_video_metadata(
       storage, VideoMetadata::descriptor_path(table_id, column_id, item_id));
@@ -200,8 +254,12 @@ VideoIndexEntry read_video_index(storehouse::StorageBackend* storage,
       storage, table_item_output_path(table_id, column_id, item_id),
       index_entry.file));
   BACKOFF_FAIL(index_entry.file->get_size(index_entry.file_size));
+  if (map_file) {
+    index_entry.mapped_file.reset(new MappedFile(index_entry.file->path()));
+  }
   index_entry.keyframe_positions = video_meta.keyframe_positions();
   index_entry.keyframe_byte_offsets = video_meta.keyframe_byte_offsets();
+  index_entry.reference_frames = video_meta.reference_frames();
   // Place total frames at the end of keyframe positions and total file size
   // at the end of byte offsets to make interval calculation not need to
   // deal with edge cases surrounding those
@@ -211,11 +269,14 @@ VideoIndexEntry read_video_index(storehouse::StorageBackend* storage,
   return index_entry;
 }
 
+// Reads into the buffers of the returned elements are appended to reads and
+// must complete before the elements are used
 void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
-                       const std::vector<i64>& rows,
-                       ElementList& element_list) {
+                       i32 table_id, i32 column_id, i64 item_start_row,
+                       const std::vector<i64>& rows, ElementList& element_list,
+                       std::vector<ReadRequest>& reads) {
   RandomReadFile* video_file = index_entry.file.get();
-  u64 file_size = index_entry.file_size;
+  const std::string video_path = video_file->path();
   const std::vector<i64>& keyframe_positions = index_entry.keyframe_positions;
   const std::vector<i64>& keyframe_byte_offsets =
       index_entry.keyframe_byte_offsets;
@@ -228,40 +289,125 @@ void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
   VideoIntervals intervals =
       slice_into_video_intervals(keyframe_positions, rows);
   size_t num_intervals = intervals.keyframe_index_intervals.size();
+  const auto& keyframe_index_intervals = intervals.keyframe_index_intervals;
+  auto interval_start = [&](size_t i) {
+    size_t k = std::get<0>(keyframe_index_intervals[i]);
+    return static_cast<u64>(keyframe_byte_offsets[k]);
+  };
+  auto interval_end = [&](size_t i) {
+    size_t k = std::get<1>(keyframe_index_intervals[i]);
+    return static_cast<u64>(keyframe_byte_offsets[k]);
+  };
+
+  std::vector<bool> keyframes_only(num_intervals);
+  for (size_t i = 0; i < num_intervals; ++i) {
+    const std::vector<i64>& valid_frames = intervals.valid_frames[i];
+    keyframes_only[i] = std::all_of(
+        valid_frames.begin(), valid_frames.end(), [&](i64 frame) {
+          return std::binary_search(keyframe_positions.begin(),
+                                    keyframe_positions.end(), frame);
+        });
+  }
+
+  // Sparse gathers skip keyframes and so produce many small intervals.
+  // Whole-GOP intervals which are close together in the file are read at
+  // once into one block, and the decode args of each point into it. The
+  // block is freed once every one of them has been decoded.
+  std::vector<u8*> gop_buffers(num_intervals, nullptr);
+  for (size_t first = 0; first < num_intervals;) {
+    if (keyframes_only[first]) {
+      first++;
+      continue;
+    }
+    size_t last = first;
+    while (last + 1 < num_intervals && !keyframes_only[last + 1] &&
+           interval_start(last + 1) - interval_end(last) <=
+               MAX_VIDEO_INTERVAL_GAP) {
+      last++;
+    }
+    u64 start = interval_start(first);
+    u64 size = interval_end(last) - start;
+    i32 refs = last - first + 1;
+    u8* block;
+    if (index_entry.mapped_file) {
+      // The decoder walks the packets in order, so let the kernel read
+      // ahead while this entry waits in the pipeline
+      block = index_entry.mapped_file->map_block(start, size, refs, true);
+      profiler.increment("io_mapped", static_cast<i64>(size));
+    } else {
+      block = new_block_buffer(CPU_DEVICE, size, refs);
+      reads.push_back(ReadRequest{video_path, start, size, block});
+      profiler.increment("io_read", static_cast<i64>(size));
+    }
+    for (size_t i = first; i <= last; ++i) {
+      gop_buffers[i] = block + (interval_start(i) - start);
+    }
+    first = last + 1;
+  }
+
   for (size_t i = 0; i < num_intervals; ++i) {
     size_t start_keyframe_index;
     size_t end_keyframe_index;
     std::tie(start_keyframe_index, end_keyframe_index) =
         intervals.keyframe_index_intervals[i];
 
-    u64 start_keyframe_byte_offset =
-        static_cast<u64>(keyframe_byte_offsets[start_keyframe_index]);
-    u64 end_keyframe_byte_offset =
-        static_cast<u64>(keyframe_byte_offsets[end_keyframe_index]);
-
+    const std::vector<i64>& valid_frames = intervals.valid_frames[i];
     i64 start_keyframe = keyframe_positions[start_keyframe_index];
     i64 end_keyframe = keyframe_positions[end_keyframe_index];
     std::vector<i64> all_keyframes;
-    for (size_t i = start_keyframe_index; i < end_keyframe_index + 1; ++i) {
-      all_keyframes.push_back(keyframe_positions[i]);
-    }
-
     std::vector<i64> all_keyframes_byte_offsets;
-    for (size_t i = start_keyframe_index; i < end_keyframe_index + 1; ++i) {
-      all_keyframes_byte_offsets.push_back(keyframe_byte_offsets[i] -
-                                           start_keyframe_byte_offset);
-    }
-
-    size_t buffer_size = end_keyframe_byte_offset - start_keyframe_byte_offset;
-    u8* buffer = new_buffer(CPU_DEVICE, buffer_size);
-
-    auto io_start = now();
+    size_t buffer_size;
+    u8* buffer;
+
+    if (keyframes_only[i]) {
+      // Every requested frame is a keyframe, so only read their packets
+      // instead of whole GOPs. Each packet is stored as its size followed
+      // by the packet bytes, which is also the layout the decoder expects.
+      std::vector<size_t> keyframe_indices;
+      std::vector<i32> packet_sizes;
+      buffer_size = 0;
+      for (i64 frame : valid_frames) {
+        size_t k = std::lower_bound(keyframe_positions.begin(),
+                                    keyframe_positions.end(), frame) -
+                   keyframe_positions.begin();
+        u64 pos = static_cast<u64>(keyframe_byte_offsets[k]);
+        i32 packet_size = s_read<i32>(video_file, pos);
+        keyframe_indices.push_back(k);
+        packet_sizes.push_back(packet_size);
+        buffer_size += sizeof(i32) + packet_size;
+      }
+      buffer = new_buffer(CPU_DEVICE, buffer_size);
+      u64 offset = 0;
+      for (size_t j = 0; j < keyframe_indices.size(); ++j) {
+        size_t k = keyframe_indices[j];
+        all_keyframes.push_back(keyframe_positions[k]);
+        all_keyframes_byte_offsets.push_back(offset);
+        u64 pos = static_cast<u64>(keyframe_byte_offsets[k]);
+        u64 size = sizeof(i32) + packet_sizes[j];
+        reads.push_back(ReadRequest{video_path, pos, size, buffer + offset});
+        offset += size;
+      }
+      all_keyframes.push_back(end_keyframe);
+      all_keyframes_byte_offsets.push_back(buffer_size);
+      profiler.increment("io_read", static_cast<i64>(buffer_size));
+    } else {
+      u64 start_keyframe_byte_offset =
+          static_cast<u64>(keyframe_byte_offsets[start_keyframe_index]);
+      u64 end_keyframe_byte_offset =
+          static_cast<u64>(keyframe_byte_offsets[end_keyframe_index]);
+
+      for (size_t i = start_keyframe_index; i < end_keyframe_index + 1; ++i) {
+        all_keyframes.push_back(keyframe_positions[i]);
+      }
 
-    u64 pos = start_keyframe_byte_offset;
-    s_read(video_file, buffer, buffer_size, pos);
+      for (size_t i = start_keyframe_index; i < end_keyframe_index + 1; ++i) {
+        all_keyframes_byte_offsets.push_back(keyframe_byte_offsets[i] -
+                                             start_keyframe_byte_offset);
+      }
 
-    profiler.add_interval("io", io_start, now());
-    profiler.increment("io_read", static_cast<i64>(buffer_size));
+      buffer_size = end_keyframe_byte_offset - start_keyframe_byte_offset;
+      buffer = gop_buffers[i];
+    }
 
     proto::DecodeArgs decode_args;
     decode_args.set_width(index_entry.width);
@@ -274,11 +420,21 @@ void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
     for (i64 k : all_keyframes_byte_offsets) {
       decode_args.add_keyframe_byte_offsets(k);
     }
-    for (size_t j = 0; j < intervals.valid_frames[i].size(); ++j) {
-      decode_args.add_valid_frames(intervals.valid_frames[i][j]);
+    for (i64 frame : valid_frames) {
+      decode_args.add_valid_frames(frame);
     }
     decode_args.set_encoded_video((i64)buffer);
     decode_args.set_encoded_video_size(buffer_size);
+    decode_args.set_table_id(table_id);
+    decode_args.set_column_id(column_id);
+    decode_args.set_item_start_row(item_start_row);
+    decode_args.set_keyframes_only(keyframes_only[i]);
+    const std::vector<bool>& reference_frames = index_entry.reference_frames;
+    if (!keyframes_only[i] && !reference_frames.empty()) {
+      for (i64 f = start_keyframe; f < end_keyframe; ++f) {
+        decode_args.add_reference_frames(reference_frames[f]);
+      }
+    }
 
     size_t size = decode_args.ByteSizeLong();
     u8* decode_args_buffer = new_buffer(CPU_DEVICE, size);
@@ -288,59 +444,129 @@ void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
   }
 }
 
-void read_other_column(storehouse::StorageBackend* storage, i32 table_id,
+// Reads into the buffers of the returned elements are appended to reads and
+// must complete before the elements are used
+void read_other_column(ElementIndexCache& element_index_cache, i32 table_id,
                        i32 column_id, i32 item_id, i32 item_start, i32 item_end,
-                       const std::vector<i64>& rows,
-                       ElementList& element_list) {
+                       const std::vector<i64>& rows, ElementList& element_list,
+                       std::vector<ReadRequest>& reads) {
   const std::vector<i64>& valid_offsets = rows;
 
-  std::unique_ptr<RandomReadFile> file;
-  StoreResult result;
-  BACKOFF_FAIL(make_unique_random_read_file(
-      storage, table_item_output_path(table_id, column_id, item_id), file));
-
-  u64 file_size = 0;
-  BACKOFF_FAIL(file->get_size(file_size));
-
-  // Read number of elements in file
-  u64 pos = 0;
-  u64 num_elements = s_read<u64>(file.get(), pos);
-
-  // Read element sizes from work item file header
-  std::vector<i64> element_sizes(num_elements);
-  s_read(file.get(), reinterpret_cast<u8*>(element_sizes.data()),
-         element_sizes.size() * sizeof(i64), pos);
-
-  // Determine start and end position of elements to read in file
-  u64 start_offset = 0;
-  for (i64 i = 0; i < item_start; ++i) {
-    start_offset += element_sizes[i];
+  // The file and element offsets of the item are shared by all load threads
+  std::shared_ptr<ElementIndex> index =
+      element_index_cache.get(table_id, column_id, item_id);
+  assert(item_end <= index->num_elements());
+
+  // Elements are views into one block which is freed with the last of them.
+  // The extra byte keeps empty elements at the end inside the block.
+  i32 num_valid = valid_offsets.size();
+  if (index->mapped()) {
+    // Elements point straight into a mapping of the range, which is
+    // unmapped once the requested elements have all been freed
+    u8* block = index->map(item_start, item_end, num_valid);
+    size_t valid_idx = 0;
+    for (i32 i = item_start; i < item_end; ++i) {
+      size_t buffer_size = static_cast<size_t>(index->element_size(i));
+      if (valid_idx < valid_offsets.size() && i == valid_offsets[valid_idx]) {
+        insert_element(element_list, block, buffer_size);
+        valid_idx++;
+      }
+      block += buffer_size;
+    }
+    assert(valid_idx == valid_offsets.size());
+    return;
   }
-  u64 end_offset = start_offset;
-  for (i64 i = item_start; i < item_end; ++i) {
-    end_offset += element_sizes[i];
+
+  // Only the requested elements are kept in the block. Each is read into its
+  // place, with runs of neighbouring elements read at once.
+  u64 valid_size = 0;
+  for (i64 i : valid_offsets) {
+    valid_size += index->element_size(i);
   }
-  u64 element_data_size = end_offset - start_offset;
-  std::vector<u8> element_data(element_data_size);
-
-  // Read chunk of file corresponding to requested elements
-  pos += start_offset;
-  s_read(file.get(), element_data.data(), element_data.size(), pos);
-
-  // Extract individual elements and insert into output work entry
-  u64 offset = 0;
-  size_t valid_idx = 0;
-  for (i32 i = item_start; i < item_end; ++i) {
-    size_t buffer_size = static_cast<size_t>(element_sizes[i]);
-    if (i == valid_offsets[valid_idx]) {
-      u8* buffer = new_buffer(CPU_DEVICE, buffer_size);
-      memcpy(buffer, element_data.data() + offset, buffer_size);
-      insert_element(element_list, buffer, buffer_size);
-      valid_idx++;
+  u8* block = new_block_buffer(CPU_DEVICE, valid_size + 1, num_valid);
+  i64 prev = -1;
+  for (i64 i : valid_offsets) {
+    u64 buffer_size = index->element_size(i);
+    if (prev != -1 && i == prev + 1) {
+      reads.back().size += buffer_size;
+    } else {
+      reads.push_back(ReadRequest{index->path(), index->element_offset(i),
+                                  buffer_size, block});
     }
-    offset += buffer_size;
+    insert_element(element_list, block, buffer_size);
+    block += buffer_size;
+    prev = i;
+  }
+}
+
+using RowIdIndex = std::map<std::tuple<i32, i32>, std::vector<i64>>;
+
+// Offsets of the rows stored in an item of a table with sparse rows
+const std::vector<i64>& read_item_row_ids(storehouse::StorageBackend* storage,
+                                          RowIdIndex& index,
+                                          const TableMetadata& table,
+                                          i32 item_id) {
+  auto key = std::make_tuple(table.id(), item_id);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    return it->second;
+  }
+  const std::string path = table_item_row_ids_path(table.id(), item_id);
+  storehouse::FileInfo info;
+  if (storage->get_file_info(path, info) != StoreResult::Success) {
+    // Items which kept every row have no row ids file
+    i64 num_rows = table.end_rows()[item_id] - table.item_start_row(item_id);
+    std::vector<i64> row_ids(num_rows);
+    std::iota(row_ids.begin(), row_ids.end(), 0);
+    it = index.emplace(key, std::move(row_ids)).first;
+  } else {
+    std::unique_ptr<RandomReadFile> file;
+    BACKOFF_FAIL(make_unique_random_read_file(storage, path, file));
+    u64 pos = 0;
+    u64 num_rows = s_read<u64>(file.get(), pos);
+    std::vector<i64> row_ids(num_rows);
+    if (num_rows > 0) {
+      s_read(file.get(), reinterpret_cast<u8*>(row_ids.data()),
+             num_rows * sizeof(i64), pos);
+    }
+    it = index.emplace(key, std::move(row_ids)).first;
+  }
+  return it->second;
+}
+
+// Clears present for the rows which a table with sparse rows does not store
+void mark_missing_rows(storehouse::StorageBackend* storage, RowIdIndex& index,
+                       const TableMetadata& table, const std::vector<i64>& rows,
+                       std::vector<bool>& present) {
+  RowIntervals intervals = slice_into_row_intervals(table, rows);
+  size_t r = 0;
+  for (size_t i = 0; i < intervals.item_ids.size(); ++i) {
+    const std::vector<i64>& row_ids =
+        read_item_row_ids(storage, index, table, intervals.item_ids[i]);
+    for (i64 offset : intervals.valid_offsets[i]) {
+      if (!std::binary_search(row_ids.begin(), row_ids.end(), offset)) {
+        present[r] = false;
+      }
+      r++;
+    }
+  }
+}
+
+// Rewrites the item offsets of rows in a table with sparse rows into the
+// positions those rows are stored at in their items
+void map_to_stored_rows(storehouse::StorageBackend* storage, RowIdIndex& index,
+                        const TableMetadata& table, RowIntervals& intervals) {
+  for (size_t i = 0; i < intervals.item_ids.size(); ++i) {
+    const std::vector<i64>& row_ids =
+        read_item_row_ids(storage, index, table, intervals.item_ids[i]);
+    std::vector<i64>& offsets = intervals.valid_offsets[i];
+    for (i64& offset : offsets) {
+      offset = std::lower_bound(row_ids.begin(), row_ids.end(), offset) -
+               row_ids.begin();
+    }
+    intervals.item_intervals[i] =
+        std::make_tuple(offsets.front(), offsets.back() + 1);
   }
-  assert(valid_idx == valid_offsets.size());
 }
 }
 
@@ -355,31 +581,66 @@ void* load_thread(void* arg) {
   storehouse::StorageBackend* storage =
       storehouse::StorageBackend::make_from_config(args.storage_config);
 
+  // Items of a local database are mapped instead of read
+  const bool map_files = is_posix_storage(args.storage_config);
+
   // Caching table metadata
   std::map<i32, TableMetadata> table_metadata;
 
   // To ammortize opening files
   i32 last_table_id = -1;
   std::map<std::tuple<i32, i32, i32>, VideoIndexEntry> index;
+  RowIdIndex row_id_index;
 
-  args.profiler.add_interval("setup", setup_start, now());
-  while (true) {
-    auto idle_start = now();
+  // Entries whose reads have been submitted, oldest first. Reads for the
+  // next entries queued for this thread are issued while earlier ones are
+  // still in flight, so storage sees many reads at once.
+  struct PendingEntry {
+    IOItem io_item;
+    EvalWorkEntry eval_work_entry;
+    std::shared_ptr<ReadBatch> reads;
+  };
+  std::deque<PendingEntry> pending;
+  bool finished = false;
 
+  args.profiler.add_interval("setup", setup_start, now());
+  while (!finished || !pending.empty()) {
     std::tuple<IOItem, LoadWorkEntry> entry;
-    args.load_work.pop(entry);
+    bool popped = false;
+    if (!finished && pending.size() < LOAD_READ_AHEAD_ITEMS) {
+      if (pending.empty()) {
+        auto idle_start = now();
+        args.load_work.pop(entry);
+        args.profiler.add_interval("idle", idle_start, now());
+        popped = true;
+      } else {
+        popped = args.load_work.try_pop(entry);
+      }
+    }
+    if (!popped) {
+      // Nothing more to start reading, so hand on the oldest entry once its
+      // reads have landed
+      PendingEntry& oldest = pending.front();
+      auto io_start = now();
+      oldest.reads->wait();
+      args.profiler.add_interval("io", io_start, now());
+      args.eval_work.push(std::make_tuple(
+          oldest.io_item, std::move(oldest.eval_work_entry)));
+      pending.pop_front();
+      continue;
+    }
+
     IOItem& io_item = std::get<0>(entry);
     LoadWorkEntry& load_work_entry = std::get<1>(entry);
 
     if (load_work_entry.io_item_index() == -1) {
-      break;
+      finished = true;
+      continue;
     }
 
     VLOG(2) << "Load (N/PU: " << args.node_id << "/" << args.id
             << "): processing item " << load_work_entry.io_item_index();
 
-    args.profiler.add_interval("idle", idle_start, now());
-
     auto work_start = now();
 
     const auto& samples = load_work_entry.samples();
@@ -388,14 +649,16 @@ void* load_thread(void* arg) {
       // Not from the same task so clear cached data
       last_table_id = io_item.table_id();
       index.clear();
+      row_id_index.clear();
     }
 
     EvalWorkEntry eval_work_entry;
     eval_work_entry.io_item_index = load_work_entry.io_item_index();
+    std::vector<ReadRequest> reads;
 
     // Aggregate all sample columns so we know the tuple size
     assert(!samples.empty());
-    eval_work_entry.warmup_rows = samples.Get(0).warmup_rows_size();
+    eval_work_entry.warmup_rows = num_warmup_rows(samples.Get(0));
 
     i32 num_columns = 0;
     for (size_t i = 0; i < samples.size(); ++i) {
@@ -403,40 +666,124 @@ void* load_thread(void* arg) {
     }
     eval_work_entry.columns.resize(num_columns);
 
-    i32 media_col_idx = 0;
-    i32 out_col_idx = 0;
-    for (const proto::LoadSample& sample : samples) {
-      i32 table_id = sample.table_id();
+    auto get_table_meta = [&](i32 table_id) -> const TableMetadata& {
       auto it = table_metadata.find(table_id);
       if (it == table_metadata.end()) {
         table_metadata[table_id] = read_table_metadata(
             storage, TableMetadata::descriptor_path(table_id));
         it = table_metadata.find(table_id);
       }
-      const TableMetadata& table_meta = it->second;
-
-      const google::protobuf::RepeatedField<i64>& sample_warmup_rows =
-          sample.warmup_rows();
-      const google::protobuf::RepeatedField<i64>& sample_rows = sample.rows();
-      std::vector<i64> rows(sample_warmup_rows.begin(),
-                            sample_warmup_rows.end());
-      rows.insert(rows.end(), sample_rows.begin(), sample_rows.end());
-      RowIntervals intervals = slice_into_row_intervals(table_meta, rows);
+      return it->second;
+    };
+
+    // Rows which a sparse input table does not store are dropped from every
+    // sample so that the columns of all samples stay aligned. Only gathers
+    // and samples of sparse tables list their rows, strided ranges are read
+    // from their bounds.
+    std::vector<std::vector<i64>> sample_rows(samples.size());
+    std::vector<bool> listed_rows(samples.size(), false);
+    std::vector<size_t> sample_row_counts;
+    std::vector<bool> row_present;
+    for (size_t s = 0; s < samples.size(); ++s) {
+      const proto::LoadSample& sample = samples.Get(s);
+      const TableMetadata& table_meta = get_table_meta(sample.table_id());
+      if (!is_range_sample(sample) || table_meta.sparse_rows()) {
+        sample_rows[s] = sample_rows_with_warmup(sample);
+        listed_rows[s] = true;
+      }
+      if (is_range_sample(sample)) {
+        RowRange warmup = row_range_from_proto(sample.warmup_range());
+        RowRange row_range = row_range_from_proto(sample.row_range());
+        sample_row_counts.push_back(warmup.size() + row_range.size());
+        eval_work_entry.sample_spans.push_back(
+            sample_span(sample.table_id(), warmup, row_range));
+      } else {
+        sample_row_counts.push_back(sample_rows[s].size());
+        eval_work_entry.sample_spans.push_back(sample_span(
+            sample.table_id(), sample_rows[s], num_warmup_rows(sample)));
+      }
+      row_present.resize(sample_row_counts[s], true);
+      if (table_meta.sparse_rows()) {
+        mark_missing_rows(storage, row_id_index, table_meta, sample_rows[s],
+                          row_present);
+      }
+    }
+    eval_work_entry.sparse_rows =
+        std::count(row_present.begin(), row_present.end(), false) > 0;
+    if (eval_work_entry.sparse_rows) {
+      for (size_t r = 0; r < row_present.size(); ++r) {
+        if (row_present[r]) {
+          eval_work_entry.row_ids.push_back(r);
+        }
+      }
+      for (size_t s = 0; s < samples.size(); ++s) {
+        std::vector<i64>& rows = sample_rows[s];
+        if (!listed_rows[s]) {
+          rows = sample_rows_with_warmup(samples.Get(s));
+          listed_rows[s] = true;
+        }
+        std::vector<i64> kept_rows;
+        for (i64 r : eval_work_entry.row_ids) {
+          kept_rows.push_back(rows[r]);
+        }
+        rows.swap(kept_rows);
+        sample_row_counts[s] = rows.size();
+      }
+    }
+
+    i32 media_col_idx = 0;
+    i32 out_col_idx = 0;
+    std::vector<size_t> reserved_capacities;
+    for (size_t s = 0; s < samples.size(); ++s) {
+      const proto::LoadSample& sample = samples.Get(s);
+      i32 table_id = sample.table_id();
+      const TableMetadata& table_meta = get_table_meta(table_id);
+
+      const std::vector<i64>& rows = sample_rows[s];
+      size_t num_rows = sample_row_counts[s];
+      RowIntervals intervals;
+      if (!listed_rows[s]) {
+        intervals = slice_into_row_intervals(
+            table_meta, {row_range_from_proto(sample.warmup_range()),
+                         row_range_from_proto(sample.row_range())});
+      } else if (!rows.empty()) {
+        intervals = slice_into_row_intervals(table_meta, rows);
+        if (table_meta.sparse_rows()) {
+          map_to_stored_rows(storage, row_id_index, table_meta, intervals);
+        }
+      }
       size_t num_items = intervals.item_ids.size();
       for (i32 col_id : sample.column_ids()) {
+        eval_work_entry.columns[out_col_idx].reserve(num_rows);
+        reserved_capacities.push_back(
+            eval_work_entry.columns[out_col_idx].capacity());
         ColumnType column_type = ColumnType::Other;
         if (table_meta.column_type(col_id) == ColumnType::Video) {
           column_type = ColumnType::Video;
           // video frame column
           FrameInfo info;
           proto::VideoDescriptor::VideoCodecType encoding_type;
+          if (num_items == 0) {
+            // Every row was filtered out, so describe the column by its
+            // first item
+            auto key = std::make_tuple(table_id, col_id, 0);
+            if (index.count(key) == 0) {
+              index[key] = read_video_index(storage, table_id, col_id, 0,
+                                            map_files);
+            }
+            const VideoIndexEntry& entry = index.at(key);
+            info = FrameInfo(entry.height, entry.width, entry.channels,
+                             entry.frame_type);
+            encoding_type = entry.codec_type;
+          }
           for (size_t i = 0; i < num_items; ++i) {
             i32 item_id = intervals.item_ids[i];
             const std::vector<i64>& valid_offsets = intervals.valid_offsets[i];
 
             auto key = std::make_tuple(table_id, col_id, item_id);
             if (index.count(key) == 0) {
-              index[key] = read_video_index(storage, table_id, col_id, item_id);
+              index[key] = read_video_index(storage, table_id, col_id,
+                                            item_id, map_files);
             }
             const VideoIndexEntry& entry = index.at(key);
             info = FrameInfo(entry.height, entry.width, entry.channels,
@@ -444,8 +791,10 @@ void* load_thread(void* arg) {
             encoding_type = entry.codec_type;
             if (entry.codec_type == proto::VideoDescriptor::H264) {
               // Video was encoded using h264
-              read_video_column(args.profiler, entry, valid_offsets,
-                                eval_work_entry.columns[out_col_idx]);
+              i64 item_start_row = table_meta.item_start_row(item_id);
+              read_video_column(args.profiler, entry, table_id, col_id,
+                                item_start_row, valid_offsets,
+                                eval_work_entry.columns[out_col_idx], reads);
             } else {
               // Video was encoded as individual images
               i32 item_id = intervals.item_ids[i];
@@ -453,12 +802,11 @@ void* load_thread(void* arg) {
               i64 item_end;
               std::tie(item_start, item_end) = intervals.item_intervals[i];
 
-              read_other_column(storage, table_id, col_id, item_id, item_start,
-                                item_end, valid_offsets,
-                                eval_work_entry.columns[out_col_idx]);
+              read_other_column(*args.element_index_cache, table_id, col_id,
+                                item_id, item_start, item_end, valid_offsets,
+                                eval_work_entry.columns[out_col_idx], reads);
             }
           }
-          assert(num_items > 0);
           eval_work_entry.frame_sizes.push_back(info);
           eval_work_entry.video_encoding_type.push_back(encoding_type);
           media_col_idx++;
@@ -471,9 +819,9 @@ void* load_thread(void* arg) {
             std::tie(item_start, item_end) = intervals.item_intervals[i];
             const std::vector<i64>& valid_offsets = intervals.valid_offsets[i];
 
-            read_other_column(storage, table_id, col_id, item_id, item_start,
-                              item_end, valid_offsets,
-                              eval_work_entry.columns[out_col_idx]);
+            read_other_column(*args.element_index_cache, table_id, col_id,
+                              item_id, item_start, item_end, valid_offsets,
+                              eval_work_entry.columns[out_col_idx], reads);
           }
         }
         eval_work_entry.column_types.push_back(column_type);
@@ -483,8 +831,14 @@ void* load_thread(void* arg) {
     }
 
     args.profiler.add_interval("task", work_start, now());
-
-    args.eval_work.push(std::make_tuple(io_item, eval_work_entry));
+    args.profiler.increment(
+        "reallocations",
+        count_reallocations(eval_work_entry.columns, reserved_capacities));
+
+    std::shared_ptr<ReadBatch> read_batch =
+        args.async_reader->submit(std::move(reads));
+    pending.push_back(
+        PendingEntry{io_item, std::move(eval_work_entry), read_batch});
   }
 
   VLOG(1) << "Load (N/PU: " << args.node_id << "/" << args.id
@@ -15,13 +15,23 @@
 
 #pragma once
 
+#include "scanner/engine/async_reader.h"
+#include "scanner/engine/element_index_cache.h"
 #include "scanner/engine/runtime.h"
+#include "scanner/engine/sampler.h"
 #include "scanner/util/common.h"
 #include "scanner/util/queue.h"
 
 namespace scanner {
 namespace internal {
 
+// IO items each load thread has reads in flight for
+static const size_t LOAD_READ_AHEAD_ITEMS = 4;
+
+// Intervals of a video at most this many bytes apart are read as one range.
+// Reading the gap costs less than the latency of a separate request.
+static const u64 MAX_VIDEO_INTERVAL_GAP = 1024 * 1024;
+
 struct LoadThreadArgs {
   // Uniform arguments
   i32 node_id;
@@ -31,6 +41,8 @@ struct LoadThreadArgs {
   int id;
   storehouse::StorageConfig* storage_config;
   Profiler& profiler;
+  ElementIndexCache* element_index_cache;
+  AsyncReader* async_reader;
 
   // Queues for communicating work
   Queue<std::tuple<IOItem, LoadWorkEntry>>& load_work;  // in
@@ -38,5 +50,21 @@ struct LoadThreadArgs {
 };
 
 void* load_thread(void* arg);
+
+struct RowIntervals {
+  std::vector<i32> item_ids;
+  std::vector<std::tuple<i64, i64>> item_intervals;
+  std::vector<std::vector<i64>> valid_offsets;
+};
+
+// Gets the list of work items for a sequence of rows in the job. Increasing
+// runs of rows within an item share one interval.
+RowIntervals slice_into_row_intervals(const TableMetadata& table,
+                                      const std::vector<i64>& rows);
+
+// Same as above for rows given as consecutive strided ranges. Items are
+// found once per item rather than once per row.
+RowIntervals slice_into_row_intervals(const TableMetadata& table,
+                                      const std::vector<RowRange>& ranges);
 }
 }
@@ -0,0 +1,226 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/load_worker.h"
+#include "scanner/engine/runtime.h"
+#include "scanner/util/util.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace scanner {
+namespace internal {
+namespace {
+
+TableMetadata make_table(const std::vector<i64>& item_sizes) {
+  proto::TableDescriptor desc;
+  i64 end_row = 0;
+  for (i64 size : item_sizes) {
+    end_row += size;
+    desc.add_end_rows(end_row);
+  }
+  return TableMetadata(desc);
+}
+
+void expect_same_intervals(const RowIntervals& a, const RowIntervals& b) {
+  EXPECT_EQ(a.item_ids, b.item_ids);
+  EXPECT_EQ(a.item_intervals, b.item_intervals);
+  EXPECT_EQ(a.valid_offsets, b.valid_offsets);
+}
+}
+
+TEST(TableMetadata, ItemForRow) {
+  TableMetadata table = make_table({3, 1, 5});
+  std::vector<i32> expected_items = {0, 0, 0, 1, 2, 2, 2, 2, 2};
+  for (i64 r = 0; r < table.num_rows(); ++r) {
+    i32 item = table.item_for_row(r);
+    EXPECT_EQ(item, expected_items[r]);
+    EXPECT_LE(table.item_start_row(item), r);
+    EXPECT_GT(table.end_rows()[item], r);
+  }
+}
+
+TEST(SliceIntoRowIntervals, SplitsOnItemsAndRepeatedRows) {
+  TableMetadata table = make_table({10, 10, 10});
+  RowIntervals intervals =
+      slice_into_row_intervals(table, std::vector<i64>{2, 5, 9, 12, 25, 4});
+  EXPECT_EQ(intervals.item_ids, (std::vector<i32>{0, 1, 2, 0}));
+  EXPECT_EQ(intervals.item_intervals,
+            (std::vector<std::tuple<i64, i64>>{std::make_tuple(2, 10),
+                                               std::make_tuple(2, 3),
+                                               std::make_tuple(5, 6),
+                                               std::make_tuple(4, 5)}));
+  EXPECT_EQ(intervals.valid_offsets,
+            (std::vector<std::vector<i64>>{{2, 5, 9}, {2}, {5}, {4}}));
+}
+
+TEST(SliceIntoRowIntervals, RangesMatchRowLists) {
+  std::mt19937 rng(0);
+  for (i32 t = 0; t < 500; ++t) {
+    std::vector<i64> item_sizes;
+    i32 num_items = 1 + rng() % 8;
+    for (i32 i = 0; i < num_items; ++i) {
+      item_sizes.push_back(1 + rng() % 40);
+    }
+    TableMetadata table = make_table(item_sizes);
+    i64 num_rows = table.num_rows();
+    i64 stride = 1 + rng() % 7;
+    i64 start = rng() % num_rows;
+    i64 warmup_start = start - std::min<i64>(start, rng() % 20);
+    i64 end = start + rng() % (num_rows - start + 1);
+    std::vector<RowRange> ranges = {RowRange{warmup_start, start, stride},
+                                    RowRange{start, end, stride}};
+    std::vector<i64> rows;
+    for (const RowRange& range : ranges) {
+      for (i64 r = range.start; r < range.end; r += range.stride) {
+        rows.push_back(r);
+      }
+    }
+    if (rows.empty()) {
+      continue;
+    }
+    expect_same_intervals(slice_into_row_intervals(table, rows),
+                          slice_into_row_intervals(table, ranges));
+  }
+}
+
+TEST(SampleSpan, ContinuesOnlyContiguousInput) {
+  // All samples with 2 warmup rows
+  std::vector<SampleSpan> first = {sample_span(0, {0, 1, 2, 3, 4}, 0)};
+  std::vector<SampleSpan> next = {sample_span(0, {3, 4, 5, 6, 7}, 2)};
+  EXPECT_TRUE(continues_samples(first, next));
+  // Same output rows, but from another table
+  EXPECT_FALSE(continues_samples(first, {sample_span(1, {3, 4, 5, 6, 7}, 2)}));
+
+  // Strided ranges over disjoint intervals
+  std::vector<SampleSpan> strided = {sample_span(0, {0, 2, 4, 6}, 1)};
+  EXPECT_TRUE(continues_samples(strided, {sample_span(0, {6, 8, 10}, 1)}));
+  EXPECT_FALSE(
+      continues_samples(strided, {sample_span(0, {4998, 5000, 5002}, 1)}));
+  EXPECT_FALSE(continues_samples(strided, {sample_span(0, {7, 8, 9}, 0)}));
+
+  // Gathered rows which are not evenly spaced
+  EXPECT_FALSE(continues_samples({sample_span(0, {0, 1, 5}, 0)},
+                                 {sample_span(0, {6, 7, 8}, 0)}));
+  // A single row does not tell its stride
+  EXPECT_FALSE(continues_samples({sample_span(0, {0}, 0)},
+                                 {sample_span(0, {1}, 0)}));
+  EXPECT_FALSE(continues_samples({}, {}));
+}
+
+TEST(SampleSpan, RangesMatchListedRows) {
+  auto listed = [](const RowRange& warmup, const RowRange& rows) {
+    std::vector<i64> all_rows;
+    for (const RowRange& range : {warmup, rows}) {
+      for (i64 r = range.start; r < range.end; r += range.stride) {
+        all_rows.push_back(r);
+      }
+    }
+    return sample_span(0, all_rows, warmup.size());
+  };
+  std::vector<std::tuple<RowRange, RowRange>> samples = {
+      std::make_tuple(RowRange{0, 0, 1}, RowRange{0, 10, 1}),
+      std::make_tuple(RowRange{4, 10, 2}, RowRange{10, 21, 2}),
+      std::make_tuple(RowRange{7, 8, 1}, RowRange{10, 11, 1}),
+      std::make_tuple(RowRange{0, 0, 3}, RowRange{5, 6, 3}),
+      std::make_tuple(RowRange{0, 6, 3}, RowRange{7, 20, 3}),
+      std::make_tuple(RowRange{0, 6, 2}, RowRange{6, 20, 3}),
+      std::make_tuple(RowRange{0, 4, 1}, RowRange{4, 4, 1})};
+  for (auto& sample : samples) {
+    SampleSpan expected = listed(std::get<0>(sample), std::get<1>(sample));
+    SampleSpan span =
+        sample_span(0, std::get<0>(sample), std::get<1>(sample));
+    EXPECT_EQ(span.start, expected.start);
+    EXPECT_EQ(span.end, expected.end);
+    EXPECT_EQ(span.stride, expected.stride);
+  }
+}
+
+TEST(CountReallocations, ComparesEachColumnWithItsOwnReserve) {
+  BatchedColumns columns(2);
+  columns[0].reserve(4);
+  columns[1].reserve(100);
+  std::vector<size_t> capacities = column_capacities(columns);
+  for (i32 i = 0; i < 4; ++i) {
+    columns[0].emplace_back(nullptr, 0);
+  }
+  EXPECT_EQ(count_reallocations(columns, capacities), 0);
+
+  // Growing past its own reserve counts, however large other columns are
+  for (i32 i = 0; i < 8; ++i) {
+    columns[0].emplace_back(nullptr, 0);
+  }
+  EXPECT_EQ(count_reallocations(columns, capacities), 1);
+
+  // A column moved in whole is not a reallocation once its capacity is taken
+  ElementList moved(200, Element(nullptr, 0));
+  columns[1] = std::move(moved);
+  capacities[1] = columns[1].capacity();
+  EXPECT_EQ(count_reallocations(columns, capacities), 1);
+}
+
+TEST(SliceIntoRowIntervals, ManyItems) {
+  const i64 num_items = 200;
+  const i64 rows_per_item = 25;
+  TableMetadata table =
+      make_table(std::vector<i64>(num_items, rows_per_item));
+  std::vector<i64> rows;
+  for (i64 r = 0; r < table.num_rows(); r += 3) {
+    rows.push_back(r);
+  }
+  RowIntervals intervals = slice_into_row_intervals(table, rows);
+  ASSERT_EQ(intervals.item_ids.size(), num_items);
+  for (i64 i = 0; i < num_items; ++i) {
+    EXPECT_EQ(intervals.item_ids[i], i);
+    for (i64 offset : intervals.valid_offsets[i]) {
+      EXPECT_EQ((i * rows_per_item + offset) % 3, 0);
+    }
+  }
+  expect_same_intervals(
+      intervals, slice_into_row_intervals(
+                     table, std::vector<RowRange>{
+                                RowRange{0, table.num_rows(), 3}}));
+}
+
+// Slicing used to scan every item for every row, which took minutes on
+// tables built from thousands of concatenated segments. Run with
+// --gtest_also_run_disabled_tests.
+TEST(SliceIntoRowIntervals, DISABLED_ManyItemsBenchmark) {
+  const i64 num_items = 20000;
+  const i64 rows_per_item = 250;
+  TableMetadata table =
+      make_table(std::vector<i64>(num_items, rows_per_item));
+  std::vector<i64> rows(num_items * rows_per_item);
+  for (size_t r = 0; r < rows.size(); ++r) {
+    rows[r] = r;
+  }
+
+  auto start = now();
+  RowIntervals intervals = slice_into_row_intervals(table, rows);
+  double row_list_seconds = nano_since(start) / 1e9;
+
+  start = now();
+  RowIntervals range_intervals = slice_into_row_intervals(
+      table, std::vector<RowRange>{RowRange{0, table.num_rows(), 1}});
+  double range_seconds = nano_since(start) / 1e9;
+
+  std::cout << "Sliced " << rows.size() << " rows over " << num_items
+            << " items: " << row_list_seconds << "s from a row list, "
+            << range_seconds << "s from a range" << std::endl;
+  expect_same_intervals(intervals, range_intervals);
+}
+}
+}
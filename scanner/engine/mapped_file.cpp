@@ -0,0 +1,93 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/mapped_file.h"
+#include "scanner/util/memory.h"
+
+#include "storehouse/posix/posix_storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace scanner {
+namespace internal {
+
+MappedFile::MappedFile(const std::string& path) : path_(path) {
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  LOG_IF(FATAL, fd_ < 0) << "Could not open " << path << ": "
+                         << strerror(errno);
+  struct stat st;
+  LOG_IF(FATAL, fstat(fd_, &st) != 0) << "Could not stat " << path << ": "
+                                      << strerror(errno);
+  size_ = st.st_size;
+}
+
+MappedFile::~MappedFile() {
+  // Mappings stay valid after the descriptor is closed
+  close(fd_);
+}
+
+void MappedFile::read(u64 offset, u64 size, u8* buffer) const {
+  assert(offset + size <= size_);
+  while (size > 0) {
+    ssize_t size_read = pread(fd_, buffer, size, offset);
+    if (size_read < 0 && errno == EINTR) {
+      continue;
+    }
+    LOG_IF(FATAL, size_read <= 0) << "Could not read " << path_ << ": "
+                                  << strerror(errno);
+    buffer += size_read;
+    offset += size_read;
+    size -= size_read;
+  }
+}
+
+u8* MappedFile::map_block(u64 offset, u64 size, i32 refs,
+                          bool sequential) const {
+  assert(offset + size <= size_);
+  assert(refs > 0);
+  static const u64 page_size = sysconf(_SC_PAGESIZE);
+  u64 map_offset = offset - offset % page_size;
+  u64 delta = offset - map_offset;
+  // One byte past the range keeps empty elements at its end inside the
+  // block. Mapping beyond the end of the file is fine as long as those bytes
+  // are never touched.
+  size_t map_size = delta + size + 1;
+  void* mapping = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd_, map_offset);
+  LOG_IF(FATAL, mapping == MAP_FAILED) << "Could not map " << path_ << ": "
+                                       << strerror(errno);
+
+  // Both are only hints, so failures are not errors
+  if (sequential) {
+    madvise(mapping, map_size, MADV_SEQUENTIAL);
+  }
+  madvise(mapping, map_size, MADV_WILLNEED);
+
+  u8* block = static_cast<u8*>(mapping);
+  adopt_block_buffer(CPU_DEVICE, block, map_size, refs,
+                     [mapping, map_size]() { munmap(mapping, map_size); });
+  return block + delta;
+}
+
+bool is_posix_storage(storehouse::StorageConfig* storage_config) {
+  return dynamic_cast<storehouse::PosixConfig*>(storage_config) != nullptr;
+}
+}
+}
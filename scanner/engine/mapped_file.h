@@ -0,0 +1,58 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "storehouse/storage_config.h"
+
+#include <string>
+
+namespace scanner {
+namespace internal {
+
+/// Read only mapping access to a file of a database on posix storage.
+///
+/// Ranges of the file are handed out as block buffers which point into the
+/// page cache, so loading them does not copy through RandomReadFile::read.
+/// Mappings are private, so ops which write to their inputs only touch their
+/// own copy of a page.
+class MappedFile {
+ public:
+  MappedFile(const std::string& path);
+
+  ~MappedFile();
+
+  u64 size() const { return size_; }
+
+  // Copies size bytes at offset into buffer. Safe to call concurrently.
+  void read(u64 offset, u64 size, u8* buffer) const;
+
+  // Maps [offset, offset + size) as a CPU block buffer of refs elements and
+  // returns a pointer to offset. The range is unmapped once every element has
+  // been deleted. The kernel is asked to start reading the range in right
+  // away, and to read ahead aggressively if it will be consumed in order.
+  u8* map_block(u64 offset, u64 size, i32 refs, bool sequential) const;
+
+ private:
+  std::string path_;
+  int fd_;
+  u64 size_;
+};
+
+// Item files can only be mapped when the database is on a local file system
+bool is_posix_storage(storehouse::StorageConfig* storage_config);
+}
+}
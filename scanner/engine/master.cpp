@@ -15,6 +15,7 @@
 
 #include "scanner/engine/master.h"
 #include <grpc/support/log.h>
+#include <algorithm>
 #include <mutex>
 #include "scanner/engine/ingest.h"
 #include "scanner/engine/sampler.h"
@@ -191,17 +192,60 @@ Result get_task_end_rows(
   if (!result.success()) {
     return result;
   }
-  i64 num_samples = sampler.total_samples();
-  for (i64 i = 0; i < num_samples; ++i) {
-    proto::NewWork new_work;
-    result = sampler.next_work(new_work);
-    if (!result.success()) {
-      rows.clear();
-      return result;
+  return sampler.sample_end_rows(rows);
+}
+
+// Removes the columns of the InputTable op that no other op consumes, along
+// with the matching sample columns, so that workers never read or decode
+// them. Returns the number of columns removed.
+i32 prune_unused_input_columns(proto::TaskSet& task_set) {
+  proto::Op* input_op = task_set.mutable_ops(0);
+  assert(input_op->name() == "InputTable");
+  std::set<std::string> used_columns;
+  for (auto& op : task_set.ops()) {
+    for (auto& input : op.inputs()) {
+      if (&op != input_op && input.op_index() == 0) {
+        used_columns.insert(input.columns().begin(), input.columns().end());
+      }
+    }
+  }
+
+  // InputTable columns are the concatenation of the sampled columns of each
+  // table, so mark which positions are still needed
+  auto& input_columns = *input_op->mutable_inputs(0)->mutable_columns();
+  std::vector<bool> keep;
+  for (const std::string& col : input_columns) {
+    keep.push_back(used_columns.count(col) > 0);
+  }
+  i32 num_removed = std::count(keep.begin(), keep.end(), false);
+  if (num_removed == 0) {
+    return 0;
+  }
+
+  google::protobuf::RepeatedPtrField<std::string> kept_columns;
+  for (size_t i = 0; i < keep.size(); ++i) {
+    if (keep[i]) {
+      kept_columns.Add()->assign(input_columns.Get(i));
+    }
+  }
+  input_columns.Swap(&kept_columns);
+
+  for (auto& task : *task_set.mutable_tasks()) {
+    size_t col_idx = 0;
+    for (auto& sample : *task.mutable_samples()) {
+      google::protobuf::RepeatedPtrField<std::string> kept_names;
+      for (const std::string& name : sample.column_names()) {
+        assert(col_idx < keep.size());
+        if (keep[col_idx++]) {
+          kept_names.Add()->assign(name);
+        }
+      }
+      // Samples whose columns are all pruned still load no data but keep
+      // their rows, since sparse tables decide which rows are present
+      sample.mutable_column_names()->Swap(&kept_names);
     }
-    rows.push_back(new_work.io_item().end_row());
   }
-  return result;
+  return num_removed;
 }
 }
 
@@ -283,7 +327,7 @@ grpc::Status MasterImpl::IngestVideos(grpc::ServerContext* context,
                                              params->table_names().end()),
                     std::vector<std::string>(params->video_paths().begin(),
                                              params->video_paths().end()),
-                    failed_videos));
+                    params->num_threads(), failed_videos));
   for (auto& failed : failed_videos) {
     result->add_failed_paths(failed.path);
     result->add_failed_messages(failed.message);
@@ -295,6 +339,33 @@ grpc::Status MasterImpl::NextWork(grpc::ServerContext* context,
                                   const proto::NodeInfo* node_info,
                                   proto::NewWork* new_work) {
   std::unique_lock<std::mutex> lk(work_mutex_);
+  if (!next_work(new_work)) {
+    new_work->Clear();
+    new_work->mutable_io_item()->set_item_id(-1);
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status MasterImpl::NextWorkBatch(grpc::ServerContext* context,
+                                       const proto::NodeInfo* node_info,
+                                       proto::NewWorkBatch* new_work_batch) {
+  i32 num_work =
+      std::max(1, std::min(MAX_WORK_BATCH_SIZE, node_info->num_work()));
+  std::unique_lock<std::mutex> lk(work_mutex_);
+  for (i32 i = 0; i < num_work; ++i) {
+    proto::NewWork* new_work = new_work_batch->add_works();
+    if (!next_work(new_work)) {
+      new_work_batch->mutable_works()->RemoveLast();
+      new_work_batch->set_done(true);
+      break;
+    }
+  }
+  VLOG(2) << "Leased " << new_work_batch->works_size() << " work entries to "
+          << "node " << node_info->node_id();
+  return grpc::Status::OK;
+}
+
+bool MasterImpl::next_work(proto::NewWork* new_work) {
   if (samples_left_ <= 0) {
     if (next_task_ < num_tasks_ && task_result_.success()) {
       // More tasks left
@@ -308,20 +379,17 @@ grpc::Status MasterImpl::NextWork(grpc::ServerContext* context,
       }
     } else {
       // No more tasks left
-      new_work->mutable_io_item()->set_item_id(-1);
-      return grpc::Status::OK;
+      return false;
     }
   }
   if (!task_result_.success()) {
-    new_work->mutable_io_item()->set_item_id(-1);
-    return grpc::Status::OK;
+    return false;
   }
 
   assert(samples_left_ > 0);
   task_result_ = task_sampler_->next_work(*new_work);
   if (!task_result_.success()) {
-    new_work->mutable_io_item()->set_item_id(-1);
-    return grpc::Status::OK;
+    return false;
   }
 
   samples_left_--;
@@ -329,7 +397,7 @@ grpc::Status MasterImpl::NextWork(grpc::ServerContext* context,
   if (bar_) {
     bar_->Progressed(total_samples_used_);
   }
-  return grpc::Status::OK;
+  return true;
 }
 
 grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
@@ -357,11 +425,28 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
     return grpc::Status::OK;
   }
 
-  // Read all table metadata
-  for (const std::string& table_name : meta.table_names()) {
-    std::string table_path =
-        TableMetadata::descriptor_path(meta.get_table_id(table_name));
-    table_metas_[table_name] = read_table_metadata(storage_, table_path);
+  // Read the metadata of the sampled tables. Databases can hold many
+  // tables, so the others are not read.
+  table_metas_.clear();
+  for (auto& task : job_params->task_set().tasks()) {
+    for (auto& sample : task.samples()) {
+      const std::string& table_name = sample.table_name();
+      if (table_metas_.count(table_name) > 0) {
+        continue;
+      }
+      std::string table_path =
+          TableMetadata::descriptor_path(meta.get_table_id(table_name));
+      table_metas_[table_name] = read_table_metadata(storage_, table_path);
+    }
+  }
+
+  // Samples are planned and handed out from job_params_ from here on
+  for (auto& task : *job_params_.mutable_task_set()->mutable_tasks()) {
+    Result result = align_samples_to_keyframes(storage_, table_metas_, task);
+    if (!result.success()) {
+      *job_result = result;
+      return grpc::Status::OK;
+    }
   }
 
   // Get output columns from last output op
@@ -413,6 +498,14 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
       assert(found);
     }
   }
+  // Output tables only hold a subset of their rows if an op can drop rows
+  bool job_filters_rows = false;
+  for (auto& op : ops) {
+    if (op.name() != "InputTable" && op.name() != "OutputTable" &&
+        op_registry->get_op_info(op.name())->can_filter()) {
+      job_filters_rows = true;
+    }
+  }
   proto::JobDescriptor job_descriptor;
   job_descriptor.set_io_item_size(io_item_size);
   job_descriptor.set_work_item_size(work_item_size);
@@ -423,7 +516,7 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
     col->CopyFrom(output_columns[i]);
   }
 
-  auto& tasks = job_params->task_set().tasks();
+  auto& tasks = job_params_.task_set().tasks();
   job_descriptor.mutable_tasks()->CopyFrom(tasks);
 
   // Add job name into database metadata so we can look up what jobs have
@@ -434,7 +527,7 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
 
   total_samples_used_ = 0;
   total_samples_ = 0;
-  for (auto& task : job_params->task_set().tasks()) {
+  for (auto& task : job_params_.task_set().tasks()) {
     i32 table_id = meta.add_table(task.output_table_name());
     proto::TableDescriptor table_desc;
     table_desc.set_id(table_id);
@@ -459,6 +552,11 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
       table_desc.add_end_rows(r);
     }
     table_desc.set_job_id(job_id);
+    bool sparse_rows = job_filters_rows;
+    for (auto& sample : task.samples()) {
+      sparse_rows |= table_metas_[sample.table_name()].sparse_rows();
+    }
+    table_desc.set_sparse_rows(sparse_rows);
 
     write_table_metadata(storage_, TableMetadata(table_desc));
     table_metas_[task.output_table_name()] = TableMetadata(table_desc);
@@ -471,6 +569,11 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
   // Write out database metadata so that workers can read it
   write_job_metadata(storage_, JobMetadata(job_descriptor));
 
+  // Workers and the task samplers only see the input columns that are used
+  i32 pruned_columns =
+      prune_unused_input_columns(*job_params_.mutable_task_set());
+  VLOG(1) << "Pruned " << pruned_columns << " unused input columns";
+
   // Setup initial task sampler
   task_result_.set_success(true);
   samples_left_ = 0;
@@ -507,7 +610,7 @@ grpc::Status MasterImpl::NewJob(grpc::ServerContext* context,
   }
 
   proto::JobParameters w_job_params;
-  w_job_params.CopyFrom(*job_params);
+  w_job_params.CopyFrom(job_params_);
   w_job_params.set_global_total(workers_.size());
   for (size_t i = 0; i < workers_.size(); ++i) {
     auto& worker = workers_[i];
@@ -576,6 +679,7 @@ grpc::Status MasterImpl::GetOpInfo(grpc::ServerContext* context,
   OpInfo* info = registry->get_op_info(op_name);
 
   op_info->set_variadic_inputs(info->variadic_inputs());
+  op_info->set_can_filter(info->can_filter());
   for (auto& input_column : info->input_columns()) {
     Column* info = op_info->add_input_columns();
     info->CopyFrom(input_column);
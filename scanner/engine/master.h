@@ -28,6 +28,10 @@
 namespace scanner {
 namespace internal {
 
+// Most work entries leased to a node by one NextWorkBatch call, so that a
+// node can not hold on to an unbounded share of the job
+static const i32 MAX_WORK_BATCH_SIZE = 256;
+
 class MasterImpl final : public proto::Master::Service {
  public:
   MasterImpl(DatabaseParameters& params);
@@ -56,6 +60,10 @@ class MasterImpl final : public proto::Master::Service {
                         const proto::NodeInfo* node_info,
                         proto::NewWork* new_work);
 
+  grpc::Status NextWorkBatch(grpc::ServerContext* context,
+                             const proto::NodeInfo* node_info,
+                             proto::NewWorkBatch* new_work_batch);
+
   grpc::Status NewJob(grpc::ServerContext* context,
                       const proto::JobParameters* job_params,
                       proto::Result* job_result);
@@ -79,6 +87,10 @@ class MasterImpl final : public proto::Master::Service {
   void start_watchdog(grpc::Server* server, i32 timeout_ms = 50000);
 
  private:
+  // Fills in the next work entry. Returns false when there is no more work.
+  // Must be called with work_mutex_ held.
+  bool next_work(proto::NewWork* new_work);
+
   std::thread watchdog_thread_;
   std::atomic<bool> watchdog_awake_;
   std::vector<std::unique_ptr<proto::Worker::Stub>> workers_;
@@ -24,6 +24,7 @@
 #include <limits.h> /* PATH_MAX */
 #include <string.h>
 #include <sys/stat.h> /* mkdir(2) */
+#include <algorithm>
 #include <cassert>
 #include <cstdarg>
 #include <iostream>
@@ -242,6 +243,11 @@ std::vector<i64> VideoMetadata::keyframe_byte_offsets() const {
                           descriptor_.keyframe_byte_offsets().end());
 }
 
+std::vector<bool> VideoMetadata::reference_frames() const {
+  return std::vector<bool>(descriptor_.reference_frames().begin(),
+                           descriptor_.reference_frames().end());
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// ImageFormatGroupMetadata
 ImageFormatGroupMetadata::ImageFormatGroupMetadata() {}
@@ -349,6 +355,8 @@ TableMetadata::TableMetadata(const TableDescriptor& table) : Metadata(table) {
   for (auto& c : descriptor_.columns()) {
     columns_.push_back(c);
   }
+  end_rows_.assign(descriptor_.end_rows().begin(),
+                   descriptor_.end_rows().end());
 }
 
 std::string TableMetadata::descriptor_path(i32 table_id) {
@@ -363,11 +371,20 @@ i64 TableMetadata::num_rows() const {
   return descriptor_.end_rows(descriptor_.end_rows_size() - 1);
 }
 
-std::vector<i64> TableMetadata::end_rows() const {
-  return std::vector<i64>(descriptor_.end_rows().begin(),
-                          descriptor_.end_rows().end());
+const std::vector<i64>& TableMetadata::end_rows() const { return end_rows_; }
+
+i32 TableMetadata::item_for_row(i64 row) const {
+  auto it = std::upper_bound(end_rows_.begin(), end_rows_.end(), row);
+  assert(it != end_rows_.end());
+  return it - end_rows_.begin();
+}
+
+i64 TableMetadata::item_start_row(i32 item_id) const {
+  return item_id == 0 ? 0 : end_rows_[item_id - 1];
 }
 
+bool TableMetadata::sparse_rows() const { return descriptor_.sparse_rows(); }
+
 const std::vector<Column>& TableMetadata::columns() const { return columns_; }
 
 std::string TableMetadata::column_name(i32 column_id) const {
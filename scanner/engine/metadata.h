@@ -52,6 +52,11 @@ inline std::string table_item_output_path(i32 table_id, i32 column_id,
          std::to_string(item_id) + ".bin";
 }
 
+inline std::string table_item_row_ids_path(i32 table_id, i32 item_id) {
+  return table_directory(table_id) + "/rows_" + std::to_string(item_id) +
+         ".bin";
+}
+
 inline std::string table_item_video_metadata_path(i32 table_id, i32 column_id,
                                                   i32 item_id) {
   return table_directory(table_id) + "/" + std::to_string(column_id) + "_" +
@@ -142,6 +147,7 @@ class VideoMetadata : public Metadata<proto::VideoDescriptor> {
   proto::VideoDescriptor::VideoCodecType codec_type() const;
   std::vector<i64> keyframe_positions() const;
   std::vector<i64> keyframe_byte_offsets() const;
+  std::vector<bool> reference_frames() const;
 };
 
 class ImageFormatGroupMetadata
@@ -205,7 +211,15 @@ class TableMetadata : public Metadata<proto::TableDescriptor> {
 
   i64 num_rows() const;
 
-  std::vector<i64> end_rows() const;
+  const std::vector<i64>& end_rows() const;
+
+  // Item holding the given row, found by binary search over end_rows
+  i32 item_for_row(i64 row) const;
+
+  // First row of the given item
+  i64 item_start_row(i32 item_id) const;
+
+  bool sparse_rows() const;
 
   const std::vector<proto::Column>& columns() const;
 
@@ -217,6 +231,7 @@ class TableMetadata : public Metadata<proto::TableDescriptor> {
 
  private:
   std::vector<proto::Column> columns_;
+  std::vector<i64> end_rows_;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
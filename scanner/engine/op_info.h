@@ -18,6 +18,7 @@
 #include "scanner/api/op.h"
 #include "scanner/util/common.h"
 
+#include <map>
 #include <vector>
 
 namespace scanner {
@@ -27,11 +28,14 @@ class OpInfo {
  public:
   OpInfo(const std::string& name, bool variadic_inputs,
          const std::vector<Column>& input_columns,
-         const std::vector<Column>& output_columns)
+         const std::vector<Column>& output_columns, bool can_filter = false,
+         const std::map<std::string, FrameFormatFn>& frame_formats = {})
     : name_(name),
       variadic_inputs_(variadic_inputs),
       input_columns_(input_columns),
-      output_columns_(output_columns) {}
+      output_columns_(output_columns),
+      can_filter_(can_filter),
+      frame_formats_(frame_formats) {}
 
   const std::string& name() const { return name_; }
 
@@ -41,11 +45,22 @@ class OpInfo {
 
   const std::vector<Column>& output_columns() const { return output_columns_; }
 
+  const bool can_filter() const { return can_filter_; }
+
+  // Shape the op wants the frames of the given input decoded to, or null if
+  // it wants full resolution RGB frames
+  FrameFormatFn frame_format(const std::string& input) const {
+    auto it = frame_formats_.find(input);
+    return it == frame_formats_.end() ? nullptr : it->second;
+  }
+
  private:
   std::string name_;
   bool variadic_inputs_;
   std::vector<Column> input_columns_;
   std::vector<Column> output_columns_;
+  bool can_filter_;
+  std::map<std::string, FrameFormatFn> frame_formats_;
 };
 }
 }
@@ -46,6 +46,7 @@ std::string default_machine_params_wrapper() {
   params_proto.set_num_cpus(params.num_cpus);
   params_proto.set_num_load_workers(params.num_load_workers);
   params_proto.set_num_save_workers(params.num_save_workers);
+  params_proto.set_frame_cache_size(params.frame_cache_size);
   for (auto gpu_id : params.gpu_ids) {
     params_proto.add_gpu_ids(gpu_id);
   }
@@ -68,6 +69,7 @@ proto::Result start_worker_wrapper(Database& db, const std::string& params_s,
   params.num_cpus = params_proto.num_cpus();
   params.num_load_workers = params_proto.num_load_workers();
   params.num_save_workers = params_proto.num_save_workers();
+  params.frame_cache_size = params_proto.frame_cache_size();
   for (auto gpu_id : params_proto.gpu_ids()) {
     params.gpu_ids.push_back(gpu_id);
   }
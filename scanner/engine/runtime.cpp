@@ -96,5 +96,94 @@ void move_if_different_address_space(Profiler& profiler,
                                     column);
   }
 }
+
+void reserve_rows(BatchedColumns& columns, size_t rows) {
+  for (ElementList& column : columns) {
+    column.reserve(rows);
+  }
+}
+
+SampleSpan sample_span(i32 table_id, const std::vector<i64>& rows,
+                       i64 warmup_rows) {
+  SampleSpan span{table_id, 0, 0, 0};
+  if ((i64)rows.size() <= warmup_rows || rows.size() < 2) {
+    // The spacing of a single row is unknown
+    return span;
+  }
+  i64 stride = rows[1] - rows[0];
+  for (size_t i = 2; i < rows.size(); ++i) {
+    if (rows[i] - rows[i - 1] != stride) {
+      return span;
+    }
+  }
+  if (stride > 0) {
+    span.start = rows[warmup_rows];
+    span.end = rows.back() + stride;
+    span.stride = stride;
+  }
+  return span;
+}
+
+SampleSpan sample_span(i32 table_id, const RowRange& warmup,
+                       const RowRange& rows) {
+  SampleSpan span{table_id, 0, 0, 0};
+  i64 num_warmup = warmup.size();
+  i64 num_rows = rows.size();
+  if (num_rows == 0 || num_warmup + num_rows < 2) {
+    return span;
+  }
+  // Spacing of the first two rows, which every other pair must share
+  i64 stride = rows.stride;
+  if (num_warmup >= 2) {
+    stride = warmup.stride;
+  } else if (num_warmup == 1) {
+    stride = rows.start - warmup.start;
+  }
+  i64 last_warmup = warmup.start + (num_warmup - 1) * warmup.stride;
+  if ((num_warmup >= 2 && warmup.stride != stride) ||
+      (num_warmup >= 1 && rows.start - last_warmup != stride) ||
+      (num_rows >= 2 && rows.stride != stride) || stride <= 0) {
+    return span;
+  }
+  span.start = rows.start;
+  span.end = rows.start + num_rows * stride;
+  span.stride = stride;
+  return span;
+}
+
+bool continues_samples(const std::vector<SampleSpan>& previous,
+                       const std::vector<SampleSpan>& next) {
+  if (previous.empty() || previous.size() != next.size()) {
+    return false;
+  }
+  for (size_t s = 0; s < next.size(); ++s) {
+    const SampleSpan& p = previous[s];
+    const SampleSpan& n = next[s];
+    if (p.stride == 0 || n.stride != p.stride || n.table_id != p.table_id ||
+        n.start != p.end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<size_t> column_capacities(const BatchedColumns& columns) {
+  std::vector<size_t> capacities;
+  for (const ElementList& column : columns) {
+    capacities.push_back(column.capacity());
+  }
+  return capacities;
+}
+
+i64 count_reallocations(const BatchedColumns& columns,
+                        const std::vector<size_t>& capacities) {
+  i64 reallocations = 0;
+  for (size_t i = 0; i < columns.size() && i < capacities.size(); ++i) {
+    if (columns[i].capacity() != capacities[i]) {
+      reallocations++;
+    }
+  }
+  return reallocations;
+}
 }
 }
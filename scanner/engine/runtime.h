@@ -21,6 +21,7 @@
 #include "scanner/engine/kernel_registry.h"
 #include "scanner/engine/metadata.h"
 #include "scanner/engine/op_registry.h"
+#include "scanner/engine/sampler.h"
 #include "scanner/engine/rpc.grpc.pb.h"
 
 #include "storehouse/storage_backend.h"
@@ -40,7 +41,41 @@ namespace internal {
 ///////////////////////////////////////////////////////////////////////////////
 /// Work structs - structs used to exchange data between workers during
 ///   execution of the run command.
+
+// Input rows that a sample of an io item reads after its warmup rows
+struct SampleSpan {
+  i32 table_id;
+  i64 start;
+  // One stride past the last row
+  i64 end;
+  // Zero when the warmup rows and rows of the sample are not evenly spaced
+  i64 stride;
+};
+
+// Span of a sample which reads rows, with its warmup rows first
+SampleSpan sample_span(i32 table_id, const std::vector<i64>& rows,
+                       i64 warmup_rows);
+
+// Span of a sample which reads the strided ranges warmup and then rows,
+// without listing their rows
+SampleSpan sample_span(i32 table_id, const RowRange& warmup,
+                       const RowRange& rows);
+
+// Whether the samples of an io item read on from where the samples of the
+// previous io item stopped, with the warmup rows of the io item being the
+// last rows of the previous one
+bool continues_samples(const std::vector<SampleSpan>& previous,
+                       const std::vector<SampleSpan>& next);
+
+// Work entries own their columns and are moved, never copied, from one
+// pipeline stage to the next.
 struct EvalWorkEntry {
+  EvalWorkEntry() = default;
+  EvalWorkEntry(const EvalWorkEntry&) = delete;
+  EvalWorkEntry& operator=(const EvalWorkEntry&) = delete;
+  EvalWorkEntry(EvalWorkEntry&&) = default;
+  EvalWorkEntry& operator=(EvalWorkEntry&&) = default;
+
   i32 io_item_index;
   BatchedColumns columns;
   std::vector<DeviceHandle> column_handles;
@@ -49,9 +84,20 @@ struct EvalWorkEntry {
   bool needs_configure;
   bool needs_reset;
   bool last_in_io_item;
+  // Warmup rows loaded before the rows of the io item. Every work item of
+  // the io item carries the same count, and rows whose id is below it are
+  // warmup rows.
   i64 warmup_rows;
+  // Offset of each row in columns from the first row loaded for the io
+  // item. Filled from pre-evaluate onwards, and by the loader when rows of
+  // an input table are missing.
+  std::vector<i64> row_ids;
+  // Set when row_ids may skip rows, because an op filtered them or an input
+  // table only stores some of its rows
+  bool sparse_rows = false;
   // Only for pre worker
   std::vector<proto::VideoDescriptor::VideoCodecType> video_encoding_type;
+  std::vector<SampleSpan> sample_spans;
   // For save and pre worker
   std::vector<FrameInfo> frame_sizes;
   std::vector<bool> compressed;
@@ -64,6 +110,7 @@ struct DatabaseParameters {
   i32 num_load_workers;
   i32 num_save_workers;
   std::vector<i32> gpu_ids;
+  i64 frame_cache_size;
 };
 
 class MasterImpl;
@@ -85,5 +132,18 @@ void move_if_different_address_space(Profiler& profiler,
                                      DeviceHandle current_handle,
                                      DeviceHandle target_handle,
                                      BatchedColumns& columns);
+
+// Reserves room for rows elements in each column so that filling them on the
+// hot path does not reallocate
+void reserve_rows(BatchedColumns& columns, size_t rows);
+
+// Capacity of each column, taken after reserving rows for them
+std::vector<size_t> column_capacities(const BatchedColumns& columns);
+
+// Number of columns whose storage was reallocated since capacities were
+// taken. Columns replaced by moving in a whole column have their capacity
+// taken again, columns added after it was taken are not counted.
+i64 count_reallocations(const BatchedColumns& columns,
+                        const std::vector<size_t>& capacities);
 }
 }
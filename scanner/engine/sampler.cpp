@@ -16,6 +16,7 @@
 #include "scanner/engine/sampler.h"
 #include "scanner/metadata.pb.h"
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
@@ -24,6 +25,17 @@ namespace internal {
 
 namespace {
 
+// Number of rows in [start, end) visited with the given stride
+i64 strided_count(i64 start, i64 end, i64 stride) {
+  return RowRange{start, end, stride}.size();
+}
+
+void set_row_range(proto::RowRange* proto_range, const RowRange& range) {
+  proto_range->set_start(range.start);
+  proto_range->set_end(range.end);
+  proto_range->set_stride(range.stride);
+}
+
 using SamplerFactory =
     std::function<Sampler*(const std::vector<u8>&, const TableMetadata&)>;
 
@@ -59,7 +71,16 @@ class AllSampler : public Sampler {
   i64 total_rows() const override { return table_.num_rows(); }
 
   i64 total_samples() const override {
-    return (int)std::ceil((float)table_.num_rows() / args_.sample_size());
+    return strided_count(0, table_.num_rows(), args_.sample_size());
+  }
+
+  i64 sample_rows(i64 sample) const override {
+    i64 s = sample * args_.sample_size();
+    return std::min(total_rows(), s + args_.sample_size()) - s;
+  }
+
+  i64 sample_warmup_rows(i64 sample) const override {
+    return std::min(sample * args_.sample_size(), args_.warmup_size());
   }
 
   RowSample next_sample() override {
@@ -69,12 +90,9 @@ class AllSampler : public Sampler {
     i64 e = std::min(total_rows(), rows_pos_ + args_.sample_size());
     rows_pos_ = e;
     assert(rows_pos_ <= total_rows());
-    for (i64 i = ws; i < s; ++i) {
-      sample.warmup_rows.push_back(i);
-    }
-    for (i64 i = s; i < e; ++i) {
-      sample.rows.push_back(i);
-    }
+    sample.is_range = true;
+    sample.warmup_range = RowRange{ws, s, 1};
+    sample.row_range = RowRange{s, e, 1};
     return sample;
   }
 
@@ -130,7 +148,7 @@ class StridedRangeSampler : public Sampler {
         return;
       }
       total_rows_ +=
-          ceil((args_.ends(i) - args_.starts(i)) / (float)args_.stride());
+          strided_count(args_.starts(i), args_.ends(i), args_.stride());
     }
     total_samples_ = args_.warmup_starts_size();
   }
@@ -141,18 +159,25 @@ class StridedRangeSampler : public Sampler {
 
   i64 total_samples() const override { return total_samples_; }
 
+  i64 sample_rows(i64 sample) const override {
+    return strided_count(args_.starts(sample), args_.ends(sample),
+                         args_.stride());
+  }
+
+  i64 sample_warmup_rows(i64 sample) const override {
+    return strided_count(args_.warmup_starts(sample), args_.starts(sample),
+                         args_.stride());
+  }
+
   RowSample next_sample() override {
     RowSample sample;
     i64 stride = args_.stride();
     i64 ws = args_.warmup_starts(samples_pos_);
     i64 s = args_.starts(samples_pos_);
     i64 e = args_.ends(samples_pos_);
-    for (i64 i = ws; i < s; i += stride) {
-      sample.warmup_rows.push_back(i);
-    }
-    for (i64 i = s; i < e; i += stride) {
-      sample.rows.push_back(i);
-    }
+    sample.is_range = true;
+    sample.warmup_range = RowRange{ws, s, stride};
+    sample.row_range = RowRange{s, e, stride};
     samples_pos_++;
     assert(samples_pos_ <= args_.warmup_starts_size());
     return sample;
@@ -228,6 +253,12 @@ class StencilSampler : public Sampler {
     return total_rows_;
   }
 
+  i64 sample_rows(i64 sample) const override { return 1; }
+
+  i64 sample_warmup_rows(i64 sample) const override {
+    return args_.stencil_size();
+  }
+
   RowSample next_sample() override {
     RowSample sample;
     i64 stride = args_.stride();
@@ -284,6 +315,14 @@ class GatherSampler : public Sampler {
 
   i64 total_samples() const override { return args_.samples_size(); }
 
+  i64 sample_rows(i64 sample) const override {
+    return args_.samples(sample).rows_size();
+  }
+
+  i64 sample_warmup_rows(i64 sample) const override {
+    return args_.samples(sample).warmup_rows_size();
+  }
+
   RowSample next_sample() override {
     RowSample sample;
     auto& s = args_.samples(samples_pos_);
@@ -345,6 +384,95 @@ Result make_sampler_instance(const std::string& sampler_type,
   return result;
 }
 
+std::vector<i64> keyframe_aligned_sample_ends(
+    const std::vector<i64>& keyframe_rows, i64 num_rows, i64 sample_size) {
+  std::vector<i64> ends;
+  i64 pos = 0;
+  while (pos < num_rows) {
+    i64 end = std::min(num_rows, pos + sample_size);
+    if (end < num_rows) {
+      // Last keyframe which keeps the sample within sample_size rows
+      auto it = std::upper_bound(keyframe_rows.begin(), keyframe_rows.end(),
+                                 end);
+      if (it != keyframe_rows.begin() && *(it - 1) >= pos + sample_size / 2 &&
+          *(it - 1) > pos) {
+        end = *(it - 1);
+      }
+    }
+    ends.push_back(end);
+    pos = end;
+  }
+  return ends;
+}
+
+Result align_samples_to_keyframes(
+    storehouse::StorageBackend* storage,
+    const std::map<std::string, TableMetadata>& table_metas,
+    proto::Task& task) {
+  Result result;
+  result.set_success(true);
+  for (proto::TableSample& sample : *task.mutable_samples()) {
+    if (sample.sampling_function() != "All") {
+      continue;
+    }
+    proto::AllSamplerArgs args;
+    if (!args.ParseFromString(sample.sampling_args())) {
+      RESULT_ERROR(&result, "All sampler provided with invalid protobuf args");
+      return result;
+    }
+    if (!args.align_to_keyframes()) {
+      continue;
+    }
+    if (args.sample_size() <= 0) {
+      RESULT_ERROR(&result,
+                   "All sampler sample size (%ld) must be greater than 0",
+                   args.sample_size());
+      return result;
+    }
+    const TableMetadata& table = table_metas.at(sample.table_name());
+    i32 video_column = -1;
+    for (const Column& column : table.columns()) {
+      if (column.type() == ColumnType::Video) {
+        video_column = column.id();
+        break;
+      }
+    }
+    if (video_column == -1) {
+      continue;
+    }
+
+    // Keyframes of every item, in rows of the table. Items are separate
+    // videos, so each of them also starts on a keyframe.
+    std::vector<i64> keyframe_rows;
+    for (i32 item = 0; item < (i32)table.end_rows().size(); ++item) {
+      i64 item_start_row = table.item_start_row(item);
+      VideoMetadata video_meta = read_video_metadata(
+          storage,
+          VideoMetadata::descriptor_path(table.id(), video_column, item));
+      for (i64 k : video_meta.keyframe_positions()) {
+        keyframe_rows.push_back(item_start_row + k);
+      }
+    }
+
+    proto::StridedRangeSamplerArgs range_args;
+    range_args.set_stride(1);
+    i64 start = 0;
+    for (i64 end : keyframe_aligned_sample_ends(
+             keyframe_rows, table.num_rows(), args.sample_size())) {
+      range_args.add_warmup_starts(
+          std::max((i64)0, start - args.warmup_size()));
+      range_args.add_starts(start);
+      range_args.add_ends(end);
+      start = end;
+    }
+    VLOG(1) << "Aligned " << range_args.starts_size() << " samples of table "
+            << sample.table_name() << " to keyframes";
+    sample.set_sampling_function("StridedRange");
+    sample.set_sampling_args(range_args.SerializeAsString());
+  }
+  return result;
+}
+
 TaskSampler::TaskSampler(
     const std::map<std::string, TableMetadata>& table_metas,
     const proto::Task& task)
@@ -430,30 +558,41 @@ Result TaskSampler::next_work(proto::NewWork& new_work) {
     for (auto col_name : sample.column_names()) {
       load_sample->add_column_ids(t_meta.column_id(col_name));
     }
-    for (i64 r : row_sample.warmup_rows) {
-      load_sample->add_warmup_rows(r);
-    }
-    for (i64 r : row_sample.rows) {
-      load_sample->add_rows(r);
+    i64 sample_warmup_rows;
+    i64 sample_rows;
+    if (row_sample.is_range) {
+      set_row_range(load_sample->mutable_warmup_range(),
+                    row_sample.warmup_range);
+      set_row_range(load_sample->mutable_row_range(), row_sample.row_range);
+      sample_warmup_rows = row_sample.warmup_range.size();
+      sample_rows = row_sample.row_range.size();
+    } else {
+      for (i64 r : row_sample.warmup_rows) {
+        load_sample->add_warmup_rows(r);
+      }
+      for (i64 r : row_sample.rows) {
+        load_sample->add_rows(r);
+      }
+      sample_warmup_rows = row_sample.warmup_rows.size();
+      sample_rows = row_sample.rows.size();
     }
     if (i == 0) {
-      warmup_rows = row_sample.warmup_rows.size();
-      rows = row_sample.rows.size();
+      warmup_rows = sample_warmup_rows;
+      rows = sample_rows;
     } else {
-      if (row_sample.warmup_rows.size() != warmup_rows) {
+      if (sample_warmup_rows != warmup_rows) {
         RESULT_ERROR(&valid_,
                      "Samplers for task %s output a different number "
                      "of warmup rows per sample (%ld vs. %ld)",
-                     task_.output_table_name().c_str(),
-                     row_sample.warmup_rows.size(), warmup_rows);
+                     task_.output_table_name().c_str(), sample_warmup_rows,
+                     warmup_rows);
         return valid_;
       }
-      if (row_sample.rows.size() != rows) {
+      if (sample_rows != rows) {
         RESULT_ERROR(&valid_,
                      "Samplers for task %s output a different number "
                      "of rows per sample (%ld vs. %ld)",
-                     task_.output_table_name().c_str(), row_sample.rows.size(),
-                     rows);
+                     task_.output_table_name().c_str(), sample_rows, rows);
         return valid_;
       }
     }
@@ -469,5 +608,42 @@ Result TaskSampler::next_work(proto::NewWork& new_work) {
 
   return valid_;
 }
+
+Result TaskSampler::sample_end_rows(std::vector<i64>& end_rows) {
+  end_rows.clear();
+  if (!valid_.success()) {
+    return valid_;
+  }
+  end_rows.reserve(total_samples_);
+  i64 allocated_rows = 0;
+  for (i64 s = 0; s < total_samples_; ++s) {
+    i64 warmup_rows = samplers_[0]->sample_warmup_rows(s);
+    i64 rows = samplers_[0]->sample_rows(s);
+    for (size_t i = 1; i < samplers_.size(); ++i) {
+      i64 sampler_warmup_rows = samplers_[i]->sample_warmup_rows(s);
+      i64 sampler_rows = samplers_[i]->sample_rows(s);
+      if (sampler_warmup_rows != warmup_rows) {
+        RESULT_ERROR(&valid_,
+                     "Samplers for task %s output a different number "
+                     "of warmup rows per sample (%ld vs. %ld)",
+                     task_.output_table_name().c_str(), sampler_warmup_rows,
+                     warmup_rows);
+        end_rows.clear();
+        return valid_;
+      }
+      if (sampler_rows != rows) {
+        RESULT_ERROR(&valid_,
+                     "Samplers for task %s output a different number "
+                     "of rows per sample (%ld vs. %ld)",
+                     task_.output_table_name().c_str(), sampler_rows, rows);
+        end_rows.clear();
+        return valid_;
+      }
+    }
+    allocated_rows += rows;
+    end_rows.push_back(allocated_rows);
+  }
+  return valid_;
+}
 }
 }
@@ -35,9 +35,25 @@ namespace internal {
    - Filter: select all rows where some predicate holds on one of the columns
  */
 
+// Every stride-th row in [start, end)
+struct RowRange {
+  i64 start = 0;
+  i64 end = 0;
+  i64 stride = 1;
+
+  i64 size() const {
+    return end > start ? (end - start + stride - 1) / stride : 0;
+  }
+};
+
 struct RowSample {
   std::vector<i64> warmup_rows;
   std::vector<i64> rows;
+  // Samples which are strided intervals set these instead of the explicit
+  // rows, so that their rows never need to be listed
+  bool is_range = false;
+  RowRange warmup_range;
+  RowRange row_range;
 };
 
 class Sampler {
@@ -55,6 +71,13 @@ class Sampler {
 
   virtual i64 total_samples() const = 0;
 
+  // Number of rows and warmup rows in the given sample. These are computed
+  // from the sampler arguments so that jobs can be planned without
+  // materializing every sample.
+  virtual i64 sample_rows(i64 sample) const = 0;
+
+  virtual i64 sample_warmup_rows(i64 sample) const = 0;
+
   virtual RowSample next_sample() = 0;
 
   virtual void reset() = 0;
@@ -69,6 +92,20 @@ Result make_sampler_instance(const std::string& sampler_type,
                              const TableMetadata& sampled_table,
                              Sampler*& sampler);
 
+// Ends of consecutive samples covering [0, num_rows) with at most sample_size
+// rows each. A sample ends on the last keyframe row within its bounds, unless
+// that would make it less than half of sample_size rows long.
+std::vector<i64> keyframe_aligned_sample_ends(
+    const std::vector<i64>& keyframe_rows, i64 num_rows, i64 sample_size);
+
+// Rewrites the All samples of task which set align_to_keyframes into
+// StridedRange samples whose ends fall on keyframes of the first video column
+// of the sampled table. Samples of tables without video are left as they are.
+Result align_samples_to_keyframes(
+    storehouse::StorageBackend* storage,
+    const std::map<std::string, TableMetadata>& table_metas,
+    proto::Task& task);
+
 class TaskSampler {
  public:
   TaskSampler(const std::map<std::string, TableMetadata>& table_metas,
@@ -82,6 +119,10 @@ class TaskSampler {
 
   Result next_work(proto::NewWork& new_work);
 
+  // Computes the end row of every io item in the output table, checking that
+  // all samplers produce matching samples.
+  Result sample_end_rows(std::vector<i64>& end_rows);
+
  private:
   const std::map<std::string, TableMetadata>& table_metas_;
   const proto::Task& task_;
@@ -0,0 +1,208 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/sampler.h"
+#include "scanner/engine/rpc.pb.h"
+#include "scanner/util/util.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+
+namespace scanner {
+namespace internal {
+namespace {
+
+TableMetadata make_table(i32 id, const std::string& name, i64 num_items,
+                         i64 rows_per_item) {
+  proto::TableDescriptor desc;
+  desc.set_id(id);
+  desc.set_name(name);
+  Column* col = desc.add_columns();
+  col->set_id(0);
+  col->set_name("frame");
+  col->set_type(ColumnType::Video);
+  for (i64 i = 1; i <= num_items; ++i) {
+    desc.add_end_rows(i * rows_per_item);
+  }
+  return TableMetadata(desc);
+}
+
+void add_sample(proto::Task& task, const std::string& table_name,
+                const std::string& function,
+                const google::protobuf::Message& args) {
+  proto::TableSample* sample = task.add_samples();
+  sample->set_table_name(table_name);
+  sample->add_column_names("frame");
+  sample->set_sampling_function(function);
+  sample->set_sampling_args(args.SerializeAsString());
+}
+
+// Computes end rows by materializing every sample, as planning used to
+std::vector<i64> materialized_end_rows(
+    const std::map<std::string, TableMetadata>& table_metas,
+    const proto::Task& task) {
+  TaskSampler sampler(table_metas, task);
+  EXPECT_TRUE(sampler.validate().success());
+  std::vector<i64> end_rows;
+  for (i64 i = 0; i < sampler.total_samples(); ++i) {
+    proto::NewWork new_work;
+    EXPECT_TRUE(sampler.next_work(new_work).success());
+    end_rows.push_back(new_work.io_item().end_row());
+  }
+  return end_rows;
+}
+
+std::vector<i64> planned_end_rows(
+    const std::map<std::string, TableMetadata>& table_metas,
+    const proto::Task& task) {
+  TaskSampler sampler(table_metas, task);
+  EXPECT_TRUE(sampler.validate().success());
+  std::vector<i64> end_rows;
+  EXPECT_TRUE(sampler.sample_end_rows(end_rows).success());
+  return end_rows;
+}
+}
+
+TEST(TaskSampler, EndRowsMatchMaterializedSamples) {
+  std::map<std::string, TableMetadata> table_metas;
+  table_metas["input"] = make_table(0, "input", 7, 113);
+  table_metas["output"] = make_table(1, "output", 1, 1);
+
+  {
+    proto::Task task;
+    task.set_output_table_name("output");
+    proto::AllSamplerArgs args;
+    args.set_sample_size(100);
+    args.set_warmup_size(17);
+    add_sample(task, "input", "All", args);
+    EXPECT_EQ(planned_end_rows(table_metas, task),
+              materialized_end_rows(table_metas, task));
+  }
+  {
+    proto::Task task;
+    task.set_output_table_name("output");
+    proto::StridedRangeSamplerArgs args;
+    args.set_stride(3);
+    for (i64 s : {0, 50, 301, 700}) {
+      args.add_warmup_starts(std::max((i64)0, s - 10));
+      args.add_starts(s);
+      args.add_ends(s + 91);
+    }
+    add_sample(task, "input", "StridedRange", args);
+    EXPECT_EQ(planned_end_rows(table_metas, task),
+              materialized_end_rows(table_metas, task));
+  }
+  {
+    proto::Task task;
+    task.set_output_table_name("output");
+    proto::GatherSamplerArgs args;
+    for (i64 n : {1, 5, 12}) {
+      auto* sample = args.add_samples();
+      for (i64 r = 0; r < n; ++r) {
+        sample->add_rows(r * 7);
+      }
+    }
+    add_sample(task, "input", "Gather", args);
+    EXPECT_EQ(planned_end_rows(table_metas, task),
+              materialized_end_rows(table_metas, task));
+  }
+}
+
+TEST(TaskSampler, MismatchedSamplesAreRejected) {
+  std::map<std::string, TableMetadata> table_metas;
+  table_metas["a"] = make_table(0, "a", 1, 100);
+  table_metas["b"] = make_table(1, "b", 1, 100);
+  table_metas["output"] = make_table(2, "output", 1, 1);
+
+  proto::Task task;
+  task.set_output_table_name("output");
+  proto::StridedRangeSamplerArgs a_args;
+  a_args.set_stride(1);
+  a_args.add_warmup_starts(0);
+  a_args.add_starts(0);
+  a_args.add_ends(50);
+  add_sample(task, "a", "StridedRange", a_args);
+  // Same number of rows but with warmup rows
+  proto::StridedRangeSamplerArgs b_args;
+  b_args.set_stride(1);
+  b_args.add_warmup_starts(0);
+  b_args.add_starts(5);
+  b_args.add_ends(55);
+  add_sample(task, "b", "StridedRange", b_args);
+
+  TaskSampler sampler(table_metas, task);
+  ASSERT_TRUE(sampler.validate().success());
+  std::vector<i64> end_rows;
+  EXPECT_FALSE(sampler.sample_end_rows(end_rows).success());
+  EXPECT_TRUE(end_rows.empty());
+}
+
+TEST(KeyframeAlignedSampleEnds, EndsOnKeyframesWithinSampleSize) {
+  // Two items of 100 rows, with keyframes every 30 rows of each item
+  std::vector<i64> keyframes = {0, 30, 60, 90, 100, 130, 160, 190};
+  EXPECT_EQ(keyframe_aligned_sample_ends(keyframes, 200, 50),
+            (std::vector<i64>{30, 60, 100, 130, 160, 200}));
+  // Keyframes too far apart to keep samples at least half full
+  EXPECT_EQ(keyframe_aligned_sample_ends({0, 90}, 100, 40),
+            (std::vector<i64>{40, 80, 100}));
+  EXPECT_EQ(keyframe_aligned_sample_ends({}, 10, 4),
+            (std::vector<i64>{4, 8, 10}));
+}
+
+namespace {
+// Plans a job sampling all 10 million rows of a table in samples of 250
+// rows and returns the end row of each sample
+std::vector<i64> plan_ten_million_rows() {
+  const i64 num_items = 50000;
+  const i64 rows_per_item = 200;
+  std::map<std::string, TableMetadata> table_metas;
+  table_metas["input"] = make_table(0, "input", num_items, rows_per_item);
+  table_metas["output"] = make_table(1, "output", 1, 1);
+
+  proto::Task task;
+  task.set_output_table_name("output");
+  proto::AllSamplerArgs args;
+  args.set_sample_size(250);
+  args.set_warmup_size(10);
+  add_sample(task, "input", "All", args);
+
+  TaskSampler sampler(table_metas, task);
+  EXPECT_TRUE(sampler.validate().success());
+  std::vector<i64> end_rows;
+  EXPECT_TRUE(sampler.sample_end_rows(end_rows).success());
+  return end_rows;
+}
+}
+
+TEST(TaskSampler, PlansTenMillionRows) {
+  std::vector<i64> end_rows = plan_ten_million_rows();
+  ASSERT_EQ(end_rows.size(), 10000000 / 250);
+  for (size_t i = 0; i < end_rows.size(); ++i) {
+    ASSERT_EQ(end_rows[i], (i64)(i + 1) * 250);
+  }
+}
+
+// Planning a job only needs the row counts of each sample, so it should not
+// scale with the number of rows being sampled. Run with
+// --gtest_also_run_disabled_tests
+TEST(TaskSampler, DISABLED_PlanTenMillionRowsTime) {
+  auto start = now();
+  plan_ten_million_rows();
+  std::cout << "Planned 10M rows in " << nano_since(start) / 1e9 << " s"
+            << std::endl;
+}
+}
+}
@@ -88,7 +88,6 @@ void* save_thread(void* arg) {
       i64 size_written = 0;
       if (work_entry.column_types[out_idx] == ColumnType::Video) {
         // Read frame info column
-        assert(work_entry.columns[out_idx].size() > 0);
         FrameInfo frame_info = work_entry.frame_sizes[video_col_idx];
 
         // Create index column
@@ -145,6 +144,9 @@ void* save_thread(void* arg) {
           for (i64 v : keyframe_byte_offsets) {
             video_descriptor.add_keyframe_byte_offsets(v);
           }
+          for (bool v : index_creator.reference_frames()) {
+            video_descriptor.add_reference_frames(v);
+          }
         } else {
           // Non h264 compressible video column
           video_descriptor.set_codec_type(proto::VideoDescriptor::RAW);
@@ -208,6 +210,25 @@ void* save_thread(void* arg) {
       args.profiler.increment("io_write", size_written);
     }
 
+    // Record which rows of the item were kept when some were dropped
+    if (work_entry.sparse_rows) {
+      auto io_start = now();
+      const std::string row_ids_path =
+          table_item_row_ids_path(io_item.table_id(), io_item.item_id());
+      WriteFile* row_ids_file = nullptr;
+      BACKOFF_FAIL(storage->make_write_file(row_ids_path, row_ids_file));
+      u64 num_rows = static_cast<u64>(work_entry.row_ids.size());
+      s_write(row_ids_file, num_rows);
+      for (i64 row_id : work_entry.row_ids) {
+        s_write(row_ids_file, row_id);
+      }
+      BACKOFF_FAIL(row_ids_file->save());
+      delete row_ids_file;
+      args.profiler.add_interval("io", io_start, now());
+      args.profiler.increment("io_write",
+                              sizeof(u64) + num_rows * sizeof(i64));
+    }
+
     VLOG(2) << "Save (N/KI: " << args.node_id << "/" << args.id
             << "): finished item " << work_entry.io_item_index;
 
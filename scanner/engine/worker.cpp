@@ -20,6 +20,7 @@
 #include "scanner/engine/runtime.h"
 #include "scanner/engine/save_worker.h"
 #include "scanner/util/cuda.h"
+#include "scanner/video/gop_decoder_pool.h"
 
 #include <arpa/inet.h>
 #include <grpc/grpc_posix.h>
@@ -64,8 +65,7 @@ void analyze_dag(
     auto& input_op = ops.Get(0);
     for (const std::string& input_col : input_op.inputs(0).columns()) {
       // Set last used to first op so that all input ops are live to start
-      // with. We could eliminate input columns which aren't used, but this
-      // also requires modifying the samples.
+      // with. The master already pruned input columns which aren't used.
       intermediates[0].push_back(std::make_tuple(input_col, 1));
     }
   }
@@ -189,6 +189,49 @@ void analyze_dag(
     }
   }
 }
+
+// The ops reading each column of the input table, with the frame shape they
+// want it decoded to. Frames are converted on the CPU while decoding, so
+// only CPU kernels ask for converted frames.
+std::vector<std::vector<FrameFormatRequest>> input_frame_formats(
+    const proto::TaskSet& task_set) {
+  OpRegistry* op_registry = get_op_registry();
+  auto& ops = task_set.ops();
+  auto& input_columns = ops.Get(0).inputs(0).columns();
+  std::vector<std::vector<FrameFormatRequest>> frame_formats(
+      input_columns.size());
+  for (i32 i = 1; i < ops.size(); ++i) {
+    auto& op = ops.Get(i);
+    OpInfo* op_info = nullptr;
+    if (i < ops.size() - 1 && op.device_type() == DeviceType::CPU) {
+      op_info = op_registry->get_op_info(op.name());
+    }
+    // Position of the column among the inputs of the op
+    size_t op_input = 0;
+    for (auto& eval_input : op.inputs()) {
+      for (const std::string& col : eval_input.columns()) {
+        FrameFormatRequest request;
+        if (op_info != nullptr && !op_info->variadic_inputs() &&
+            op_input < op_info->input_columns().size()) {
+          request.format = op_info->frame_format(
+              op_info->input_columns()[op_input].name());
+          request.args.assign(op.kernel_args().begin(),
+                              op.kernel_args().end());
+        }
+        op_input++;
+        if (eval_input.op_index() != 0) {
+          continue;
+        }
+        for (i32 c = 0; c < input_columns.size(); ++c) {
+          if (input_columns.Get(c) == col) {
+            frame_formats[c].push_back(request);
+          }
+        }
+      }
+    }
+  }
+  return frame_formats;
+}
 }
 
 WorkerImpl::WorkerImpl(DatabaseParameters& db_params,
@@ -213,6 +256,7 @@ WorkerImpl::WorkerImpl(DatabaseParameters& db_params,
   params->set_num_cpus(db_params_.num_cpus);
   params->set_num_load_workers(db_params_.num_cpus);
   params->set_num_save_workers(db_params_.num_cpus);
+  params->set_frame_cache_size(db_params_.frame_cache_size);
   for (i32 gpu_id : db_params_.gpu_ids) {
     params->add_gpu_ids(gpu_id);
   }
@@ -230,6 +274,15 @@ WorkerImpl::WorkerImpl(DatabaseParameters& db_params,
   storage_ =
       storehouse::StorageBackend::make_from_config(db_params_.storage_config);
 
+  if (db_params_.frame_cache_size > 0) {
+    frame_cache_.reset(new FrameCache(db_params_.frame_cache_size));
+  }
+  element_index_cache_.reset(new ElementIndexCache(
+      db_params_.storage_config, DEFAULT_ELEMENT_INDEX_CACHE_ITEMS));
+  async_reader_.reset(new AsyncReader(db_params_.storage_config,
+                                      DEFAULT_ASYNC_READ_THREADS));
+  codec_thread_budget_.reset(new CodecThreadBudget());
+
   // Set up Python runtime if any kernels need it
   Py_Initialize();
   boost::python::numpy::initialize();
@@ -285,6 +338,8 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   std::vector<std::vector<i32>> column_mapping;
   analyze_dag(job_params->task_set(), live_columns, dead_columns,
               unused_outputs, column_mapping);
+  std::vector<std::vector<FrameFormatRequest>> frame_formats =
+      input_frame_formats(job_params->task_set());
 
   // Read final output columns for use in post-evaluate worker
   // (needed for determining column types)
@@ -485,7 +540,11 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
 
   // Setup shared resources for distributing work to processing threads
   i64 accepted_items = 0;
-  Queue<std::tuple<IOItem, LoadWorkEntry>> load_work;
+  // Never hold more than a node's worth of leased work, so that the monitor
+  // loop below can queue a whole batch without blocking
+  const i32 target_local_work =
+      pipeline_instances_per_node * TASKS_IN_QUEUE_PER_PU;
+  Queue<std::tuple<IOItem, LoadWorkEntry>> load_work(target_local_work);
   Queue<std::tuple<IOItem, EvalWorkEntry>> initial_eval_work;
   std::vector<std::vector<Queue<std::tuple<IOItem, EvalWorkEntry>>>> eval_work(
       pipeline_instances_per_node);
@@ -498,6 +557,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   for (i32 i = 0; i < num_load_workers; ++i) {
     load_thread_profilers.emplace_back(Profiler(base_time));
   }
+  AsyncReader::Stats read_stats_start = async_reader_->stats();
   std::vector<LoadThreadArgs> load_thread_args;
   for (i32 i = 0; i < num_load_workers; ++i) {
     // Create IO thread for reading and decoding data
@@ -507,6 +567,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
 
         // Per worker arguments
         i, db_params_.storage_config, load_thread_profilers[i],
+        element_index_cache_.get(), async_reader_.get(),
 
         // Queues
         load_work, initial_eval_work,
@@ -527,6 +588,15 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
       pipeline_instances_per_node);
   std::vector<PostEvaluateThreadArgs> post_eval_args;
 
+  // Cores left idle by few pipeline instances decode GOPs of their io items
+  // concurrently
+  i32 gop_decoders =
+      std::max(1, std::min(MAX_GOP_DECODERS, num_cpus / local_total /
+                                                 pipeline_instances_per_node));
+  // Each pipeline instance decodes on its GOP decoders and encodes its output
+  codec_thread_budget_->start_job(
+      num_cpus / local_total, pipeline_instances_per_node * (gop_decoders + 1));
+
   i32 next_cpu_num = 0;
   i32 next_gpu_idx = 0;
   for (i32 ki = 0; ki < pipeline_instances_per_node; ++ki) {
@@ -609,10 +679,11 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
       assert(kernel_groups.size() > 0);
       pre_eval_args.emplace_back(PreEvaluateThreadArgs{
           // Uniform arguments
-          node_id_, num_cpus, job_params,
+          node_id_, num_cpus, gop_decoders, job_params,
 
           // Per worker arguments
           ki, first_kernel_type, eval_thread_profilers.front(),
+          frame_cache_.get(), codec_thread_budget_.get(), frame_formats,
 
           // Queues
           *input_work_queue, *output_work_queue});
@@ -638,6 +709,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
           // Per worker arguments
           ki, eval_thread_profilers.back(), column_mapping.back(),
           final_output_columns, final_compression_options,
+          codec_thread_budget_.get(),
 
           // Queues
           *input_work_queue, *output_work_queue});
@@ -690,31 +762,56 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
 #endif
   timepoint_t start_time = now();
 
-  // Monitor amount of work left and request more when running low
+  // Monitor amount of work left and request more when running low. Work is
+  // leased from the master in batches sized to refill the local queues, and
+  // the request is issued asynchronously so that error checking and queue
+  // monitoring continue while the RPC is in flight.
+  grpc::CompletionQueue work_cq;
+  std::unique_ptr<grpc::ClientContext> work_context;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<proto::NewWorkBatch>>
+      work_rpc;
+  proto::NewWorkBatch work_batch;
+  grpc::Status work_status;
+  bool work_request_pending = false;
   while (true) {
-    i32 local_work = accepted_items - retired_items;
-    if (local_work < pipeline_instances_per_node * TASKS_IN_QUEUE_PER_PU) {
-      grpc::ClientContext context;
-      proto::NodeInfo node_info;
-      proto::NewWork new_work;
-
-      node_info.set_node_id(node_id_);
-      grpc::Status status = master_->NextWork(&context, node_info, &new_work);
-      if (!status.ok()) {
-        RESULT_ERROR(job_result,
-                     "Worker %d could not get next work from master", node_id_);
-        break;
+    if (!work_request_pending) {
+      i32 local_work = accepted_items - retired_items;
+      if (local_work < target_local_work) {
+        proto::NodeInfo node_info;
+        node_info.set_node_id(node_id_);
+        node_info.set_num_work(target_local_work - local_work);
+
+        work_batch.Clear();
+        work_context.reset(new grpc::ClientContext);
+        work_rpc = master_->AsyncNextWorkBatch(work_context.get(), node_info,
+                                               &work_cq);
+        work_rpc->Finish(&work_batch, &work_status, (void*)1);
+        work_request_pending = true;
       }
-
-      i32 next_item = new_work.io_item().item_id();
-      if (next_item == -1) {
-        // No more work left
-        VLOG(1) << "Node " << node_id_ << " received done signal.";
-        break;
-      } else {
-        load_work.push(
-            std::make_tuple(new_work.io_item(), new_work.load_work()));
-        accepted_items++;
+    } else {
+      void* got_tag;
+      bool ok = false;
+      gpr_timespec deadline = gpr_time_0(GPR_CLOCK_REALTIME);
+      if (work_cq.AsyncNext(&got_tag, &ok, deadline) ==
+          grpc::CompletionQueue::GOT_EVENT) {
+        GPR_ASSERT(ok);
+        work_request_pending = false;
+        if (!work_status.ok()) {
+          RESULT_ERROR(job_result,
+                       "Worker %d could not get next work from master",
+                       node_id_);
+          break;
+        }
+        for (auto& new_work : work_batch.works()) {
+          load_work.push(
+              std::make_tuple(new_work.io_item(), new_work.load_work()));
+          accepted_items++;
+        }
+        if (work_batch.done()) {
+          // No more work left
+          VLOG(1) << "Node " << node_id_ << " received done signal.";
+          break;
+        }
       }
     }
 
@@ -737,6 +834,20 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
 
     std::this_thread::yield();
   }
+  if (work_request_pending) {
+    // Abandon the outstanding lease request and drain the completion queue
+    void* got_tag;
+    bool ok = false;
+    work_context->TryCancel();
+    work_cq.Next(&got_tag, &ok);
+  }
+  work_cq.Shutdown();
+  {
+    void* got_tag;
+    bool ok = false;
+    while (work_cq.Next(&got_tag, &ok)) {
+    }
+  }
 
   // If the job failed, can't expect queues to have drained, so
   // attempt to flush all all queues here (otherwise we could block
@@ -759,7 +870,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   for (i32 i = 0; i < num_load_workers; ++i) {
     LoadWorkEntry entry;
     entry.set_io_item_index(-1);
-    load_work.push(std::make_tuple(IOItem{}, entry));
+    load_work.push(std::make_tuple(IOItem{}, std::move(entry)));
   }
 
   for (i32 i = 0; i < num_load_workers; ++i) {
@@ -770,11 +881,32 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     free(result);
   }
 
+  // Reads are shared by all load threads, so they are reported once
+  if (num_load_workers > 0) {
+    AsyncReader::Stats read_stats = async_reader_->stats();
+    i64 read_bytes = read_stats.bytes - read_stats_start.bytes;
+    i64 busy_ns = read_stats.busy_ns - read_stats_start.busy_ns;
+    i64 read_ns = read_stats.read_ns - read_stats_start.read_ns;
+    Profiler& profiler = load_thread_profilers[0];
+    profiler.increment("io_requests",
+                       read_stats.requests - read_stats_start.requests);
+    profiler.increment("io_reads", read_stats.reads - read_stats_start.reads);
+    profiler.increment("io_busy_ns", busy_ns);
+    if (busy_ns > 0) {
+      // Average reads outstanding while any were, in hundredths
+      profiler.increment("io_queue_depth_x100", read_ns * 100 / busy_ns);
+      profiler.increment("io_bytes_per_sec", read_bytes * 1e9 / busy_ns);
+      VLOG(1) << "Node " << node_id_ << " read " << read_bytes << " bytes at "
+              << read_bytes * 1e3 / busy_ns << " MB/s, queue depth "
+              << (f64)read_ns / busy_ns;
+    }
+  }
+
   // Push sentinel work entries into queue to terminate eval threads
   for (i32 i = 0; i < pipeline_instances_per_node; ++i) {
     EvalWorkEntry entry;
     entry.io_item_index = -1;
-    initial_eval_work.push(std::make_tuple(IOItem{}, entry));
+    initial_eval_work.push(std::make_tuple(IOItem{}, std::move(entry)));
   }
 
   for (i32 i = 0; i < pipeline_instances_per_node; ++i) {
@@ -789,7 +921,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
       EvalWorkEntry entry;
       entry.io_item_index = -1;
-      eval_work[pu][kg].push(std::make_tuple(IOItem{}, entry));
+      eval_work[pu][kg].push(std::make_tuple(IOItem{}, std::move(entry)));
     }
     for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
       // Wait until eval has finished
@@ -804,7 +936,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
     EvalWorkEntry entry;
     entry.io_item_index = -1;
-    eval_work[pu].back().push(std::make_tuple(IOItem{}, entry));
+    eval_work[pu].back().push(std::make_tuple(IOItem{}, std::move(entry)));
   }
   for (i32 pu = 0; pu < pipeline_instances_per_node; ++pu) {
     // Wait until eval has finished
@@ -818,7 +950,7 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
   for (i32 i = 0; i < num_save_workers; ++i) {
     EvalWorkEntry entry;
     entry.io_item_index = -1;
-    save_work.push(std::make_tuple(IOItem{}, entry));
+    save_work.push(std::make_tuple(IOItem{}, std::move(entry)));
   }
   for (i32 i = 0; i < num_save_workers; ++i) {
     // Wait until eval has finished
@@ -828,6 +960,58 @@ grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
     free(result);
   }
 
+  // Report memory pool usage for tuning MemoryPoolConfig
+  {
+    std::vector<DeviceHandle> pool_devices = {CPU_DEVICE};
+    for (i32 gpu_id : gpu_ids) {
+      pool_devices.push_back(DeviceHandle{DeviceType::GPU, gpu_id});
+    }
+    for (DeviceHandle device : pool_devices) {
+      MemoryPoolStats stats;
+      if (memory_pool_stats(device, stats)) {
+        VLOG(1) << "Node " << node_id_ << " memory pool (" << device.id
+                << "): high water mark " << stats.high_water_mark << " of "
+                << stats.pool_size << " bytes, fragmentation "
+                << stats.fragmentation;
+      }
+    }
+  }
+  // Report the cost of the codecs for tuning their thread budget. CPU time
+  // is that of the threads calling into the codecs, which excludes the
+  // threads libavcodec starts for contexts of more than one thread.
+  {
+    i64 decode_thread_cpu_ns = 0;
+    i64 frames_decoded = 0;
+    i64 encode_thread_cpu_ns = 0;
+    i64 frames_encoded = 0;
+    auto counter = [](const std::map<std::string, int64_t>& counters,
+                      const std::string& key) {
+      auto it = counters.find(key);
+      return it == counters.end() ? 0 : it->second;
+    };
+    for (auto& profilers : eval_profilers) {
+      auto& pre_counters = profilers.front().get_counters();
+      auto& post_counters = profilers.back().get_counters();
+      decode_thread_cpu_ns += counter(pre_counters, "decode_thread_cpu_ns");
+      frames_decoded += counter(pre_counters, "frames_decoded");
+      encode_thread_cpu_ns += counter(post_counters, "encode_thread_cpu_ns");
+      frames_encoded += counter(post_counters, "frames_encoded");
+    }
+    VLOG(1) << "Node " << node_id_ << " codecs: "
+            << decode_thread_cpu_ns / 1000.0 / std::max(frames_decoded, (i64)1)
+            << " us calling-thread CPU per decoded frame, "
+            << encode_thread_cpu_ns / 1000.0 / std::max(frames_encoded, (i64)1)
+            << " us calling-thread CPU per encoded frame, "
+            << codec_thread_budget_->context_threads()
+            << " threads per context with "
+            << codec_thread_budget_->idle_fraction() << " of the node idle";
+  }
+  if (frame_cache_) {
+    VLOG(1) << "Node " << node_id_ << " frame cache holds "
+            << frame_cache_->size() << " of " << frame_cache_->capacity()
+            << " bytes";
+  }
+
 // Ensure all files are flushed
 #ifdef SCANNER_PROFILING
   std::fflush(NULL);
@@ -15,6 +15,10 @@
 
 #pragma once
 
+#include "scanner/engine/async_reader.h"
+#include "scanner/engine/codec_thread_budget.h"
+#include "scanner/engine/element_index_cache.h"
+#include "scanner/engine/frame_cache.h"
 #include "scanner/engine/metadata.h"
 #include "scanner/engine/rpc.grpc.pb.h"
 #include "scanner/engine/runtime.h"
@@ -61,6 +65,14 @@ class WorkerImpl final : public proto::Worker::Service {
   std::map<std::string, TableMetadata*> table_metas_;
   bool memory_pool_initialized_ = false;
   MemoryPoolConfig cached_memory_pool_config_;
+  // Decoded frames kept across jobs, null if caching is disabled
+  std::unique_ptr<FrameCache> frame_cache_;
+  // Element offsets of non-video column items
+  std::unique_ptr<ElementIndexCache> element_index_cache_;
+  // Serves the reads of all load threads
+  std::unique_ptr<AsyncReader> async_reader_;
+  // Threads of the codec contexts of all pipeline instances
+  std::unique_ptr<CodecThreadBudget> codec_thread_budget_;
 };
 }
 }
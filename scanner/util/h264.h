@@ -17,18 +17,38 @@
 
 #include "scanner/util/common.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace scanner {
 
+// Reads bits starting at offset bits into buffer. With rbsp set, buffer
+// holds the bytes of a NAL unit after its header, or the whole NAL unit when
+// reading from offset 8, and the emulation prevention byte of each 0x000003
+// sequence is skipped as it is reached. The NAL is read in place instead of
+// being copied into a separate RBSP.
 struct GetBitsState {
   const u8* buffer;
   i64 offset;
+  // Bytes in buffer, only needed with rbsp
   i64 size;
+  bool rbsp = false;
 };
 
 inline u32 get_bit(GetBitsState& gb) {
   u8 v =
       ((*(gb.buffer + (gb.offset >> 0x3))) >> (0x7 - (gb.offset & 0x7))) & 0x1;
   gb.offset++;
+  if (gb.rbsp && (gb.offset & 0x7) == 0) {
+    i64 byte = gb.offset >> 0x3;
+    if (byte >= 2 && byte < gb.size && gb.buffer[byte] == 0x03 &&
+        gb.buffer[byte - 1] == 0x00 && gb.buffer[byte - 2] == 0x00) {
+      gb.offset += 8;
+    }
+  }
   return v;
 }
 
@@ -74,17 +94,72 @@ inline u32 get_se_golomb(GetBitsState& gb) {
   return (info - 1);
 }
 
+// Returns the first position p in [start, end - 2) where p[0] and p[1] are
+// zero and p[2] is one, or at most one if end_of_nal is set. Returns end if
+// there is none. Compressed data rarely holds two zero bytes in a row, so
+// whole vectors of positions are checked at once.
+inline const u8* find_start_code(const u8* start, const u8* end,
+                                 bool end_of_nal) {
+  const u8* p = start;
+#if defined(__AVX2__)
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  while (end - p >= 34) {
+    __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+    __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+    __m256i third = end_of_nal
+                        ? _mm256_cmpeq_epi8(_mm256_min_epu8(b2, one), b2)
+                        : _mm256_cmpeq_epi8(b2, one);
+    __m256i match = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                         _mm256_cmpeq_epi8(b1, zero)),
+        third);
+    u32 mask = static_cast<u32>(_mm256_movemask_epi8(match));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 32;
+  }
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  while (end - p >= 18) {
+    __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+    __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+    __m128i third = end_of_nal ? _mm_cmpeq_epi8(_mm_min_epu8(b2, one), b2)
+                               : _mm_cmpeq_epi8(b2, one);
+    __m128i match = _mm_and_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+        third);
+    u32 mask = static_cast<u32>(_mm_movemask_epi8(match));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+  for (; end - p > 2; ++p) {
+    if (p[0] == 0x00 && p[1] == 0x00 &&
+        (p[2] == 0x01 || (end_of_nal && p[2] == 0x00))) {
+      return p;
+    }
+  }
+  return end;
+}
+
 inline void next_nal(const u8*& buffer, i32& buffer_size_left,
                      const u8*& nal_start, i32& nal_size) {
-  bool found = false;
-  while (buffer_size_left > 2) {
-    if (buffer[0] == 0x00 && buffer[1] == 0x00 && buffer[2] == 0x01) {
-      found = true;
-      break;
-    }
-    buffer++;
-    buffer_size_left--;
+  const u8* end = buffer + buffer_size_left;
+  const u8* start_code = find_start_code(buffer, end, false);
+  bool found = start_code != end;
+  if (found) {
+    buffer = start_code;
+  } else if (buffer_size_left > 2) {
+    buffer = end - 2;
   }
+  buffer_size_left = end - buffer;
 
   buffer += 3;
   buffer_size_left -= 3;
@@ -95,13 +170,15 @@ inline void next_nal(const u8*& buffer, i32& buffer_size_left,
   if (!found) {
     return;
   }
-  while (buffer_size_left > 2 &&
-         !(buffer[0] == 0x00 && buffer[1] == 0x00 &&
-           (buffer[2] == 0x00 || buffer[2] == 0x01))) {
-    buffer++;
-    buffer_size_left--;
-    nal_size++;
+  const u8* nal_end = find_start_code(buffer, end, true);
+  if (nal_end == end && buffer_size_left > 2) {
+    nal_end = end - 2;
+  } else if (nal_end == end) {
+    nal_end = buffer;
   }
+  nal_size = nal_end - buffer;
+  buffer = nal_end;
+  buffer_size_left = end - buffer;
   if (!(buffer_size_left > 3)) {
     nal_size += buffer_size_left;
     // Not sure if this is needed or not...
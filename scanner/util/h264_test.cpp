@@ -0,0 +1,191 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scanner/util/h264.h"
+#include "scanner/util/util.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+namespace scanner {
+namespace {
+
+// The byte by byte scan next_nal used to do
+void next_nal_bytewise(const u8*& buffer, i32& buffer_size_left,
+                       const u8*& nal_start, i32& nal_size) {
+  bool found = false;
+  while (buffer_size_left > 2) {
+    if (buffer[0] == 0x00 && buffer[1] == 0x00 && buffer[2] == 0x01) {
+      found = true;
+      break;
+    }
+    buffer++;
+    buffer_size_left--;
+  }
+
+  buffer += 3;
+  buffer_size_left -= 3;
+
+  nal_start = buffer;
+  nal_size = 0;
+
+  if (!found) {
+    return;
+  }
+  while (buffer_size_left > 2 &&
+         !(buffer[0] == 0x00 && buffer[1] == 0x00 &&
+           (buffer[2] == 0x00 || buffer[2] == 0x01))) {
+    buffer++;
+    buffer_size_left--;
+    nal_size++;
+  }
+  if (!(buffer_size_left > 3)) {
+    nal_size += buffer_size_left;
+  }
+}
+
+// Random bytes with NALs starting every nal_bytes bytes on average. Zeros
+// are made common so that partial start codes show up at every offset.
+std::vector<u8> make_stream(std::mt19937& rng, size_t size, i32 nal_bytes,
+                            i32 zero_percent) {
+  std::vector<u8> stream(size);
+  for (u8& b : stream) {
+    b = static_cast<i32>(rng() % 100) < zero_percent ? 0 : rng() % 256;
+  }
+  for (size_t i = 0; i + 4 < size; i += 1 + rng() % (2 * nal_bytes)) {
+    stream[i] = 0x00;
+    stream[i + 1] = 0x00;
+    stream[i + 2] = 0x01;
+    stream[i + 3] = 0x65;
+  }
+  return stream;
+}
+
+// Splits a stream into NALs as H264ByteStreamIndexCreator does
+template <typename NextNal>
+i64 count_nals(const std::vector<u8>& stream, NextNal next) {
+  const u8* buffer = stream.data();
+  i32 size_left = stream.size();
+  i64 nals = 0;
+  while (size_left > 3) {
+    const u8* nal_start;
+    i32 nal_size;
+    next(buffer, size_left, nal_start, nal_size);
+    nals++;
+  }
+  return nals;
+}
+}
+
+TEST(NextNal, MatchesBytewiseScan) {
+  std::mt19937 rng(0);
+  for (i32 round = 0; round < 2000; ++round) {
+    std::vector<u8> stream =
+        make_stream(rng, 1 + rng() % 300, 1 + rng() % 40, rng() % 80);
+    const u8* buffer = stream.data();
+    i32 size_left = stream.size();
+    const u8* expected_buffer = buffer;
+    i32 expected_size_left = size_left;
+    while (expected_size_left > 3) {
+      const u8* nal_start;
+      i32 nal_size;
+      const u8* expected_nal_start;
+      i32 expected_nal_size;
+      next_nal(buffer, size_left, nal_start, nal_size);
+      next_nal_bytewise(expected_buffer, expected_size_left,
+                        expected_nal_start, expected_nal_size);
+      ASSERT_EQ(nal_start, expected_nal_start);
+      ASSERT_EQ(nal_size, expected_nal_size);
+      ASSERT_EQ(buffer, expected_buffer);
+      ASSERT_EQ(size_left, expected_size_left);
+    }
+  }
+}
+
+TEST(GetBitsState, ReadsRbspInPlace) {
+  std::mt19937 rng(0);
+  for (i32 round = 0; round < 1000; ++round) {
+    // A NAL payload with emulation prevention bytes
+    std::vector<u8> nal;
+    i32 size = 1 + rng() % 200;
+    for (i32 i = 0; i < size; ++i) {
+      if (nal.size() >= 2 && nal[nal.size() - 1] == 0 &&
+          nal[nal.size() - 2] == 0) {
+        nal.push_back(0x03);
+      }
+      nal.push_back(rng() % 3 == 0 ? 0 : rng() % 256);
+    }
+    // Strip them by copying, as parsing used to
+    std::vector<u8> rbsp;
+    u32 zeros = 0;
+    for (u8 b : nal) {
+      if (zeros < 2 || b != 0x03) {
+        rbsp.push_back(b);
+      }
+      zeros = b == 0 ? zeros + 1 : 0;
+    }
+
+    GetBitsState gb;
+    gb.buffer = nal.data();
+    gb.offset = 0;
+    gb.size = nal.size();
+    gb.rbsp = true;
+    for (size_t i = 0; i < rbsp.size(); ++i) {
+      ASSERT_EQ(get_bits(gb, 8), rbsp[i]) << "byte " << i;
+    }
+  }
+}
+
+TEST(NextNal, MatchesBytewiseScanOnLongNals) {
+  std::mt19937 rng(0);
+  // About the NAL size of 1080p video, so that most of the stream is
+  // scanned by the vector loops
+  std::vector<u8> stream = make_stream(rng, 4 * 1024 * 1024, 20000, 0);
+  i64 nals = count_nals(stream, next_nal);
+  EXPECT_GT(nals, 100);
+  EXPECT_EQ(nals, count_nals(stream, next_nal_bytewise));
+}
+
+// Splitting gigabytes of video into NALs should take a fraction of the time
+// it takes to read them. Run with --gtest_also_run_disabled_tests.
+TEST(NextNal, DISABLED_ScanThroughput) {
+  std::mt19937 rng(0);
+  std::vector<u8> stream = make_stream(rng, 256 * 1024 * 1024, 20000, 0);
+  const i32 passes = 8;
+  f64 gigabytes = passes * stream.size() / 1e9;
+
+  i64 nals = 0;
+  auto start = now();
+  for (i32 i = 0; i < passes; ++i) {
+    nals += count_nals(stream, next_nal);
+  }
+  f64 seconds = nano_since(start) / 1e9;
+
+  i64 expected_nals = 0;
+  start = now();
+  for (i32 i = 0; i < passes; ++i) {
+    expected_nals += count_nals(stream, next_nal_bytewise);
+  }
+  f64 bytewise_seconds = nano_since(start) / 1e9;
+
+  EXPECT_EQ(nals, expected_nals);
+  std::cout << "Scanned " << gigabytes << " GB for start codes at "
+            << gigabytes / seconds << " GB/s, byte by byte at "
+            << gigabytes / bytewise_seconds << " GB/s" << std::endl;
+}
+}
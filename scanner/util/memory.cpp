@@ -19,8 +19,16 @@
 #include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <map>
 #include <mutex>
+#include <set>
+#include <unordered_map>
 
 #ifdef HAVE_CUDA
 #include <cuda.h>
@@ -144,59 +152,88 @@ bool pointer_in_buffer(u8* ptr, u8* buf_start, u8* buf_end) {
   return (size_t)ptr >= (size_t)buf_start && (size_t)ptr < (size_t)buf_end;
 }
 
+// Two-level segregated fit (TLSF) allocator over a pool that is allocated up
+// front. Free blocks are binned by size class and found with two bitmap
+// scans, and physically adjacent free blocks are merged on free, so both
+// allocate and free are O(1). Block bookkeeping lives on the host, which
+// allows the pool itself to be device memory.
+//
+// Freed blocks are first offered to a small cache of the thread which
+// allocated them, so that the common pattern of repeatedly allocating same
+// sized buffers (e.g. frames) does not contend on the pool lock. Buffers are
+// usually freed by a later pipeline stage than the one which allocated them,
+// so caching by the freeing thread would park blocks where they are never
+// asked for again. The map from pointers to blocks is sharded for the same
+// reason.
 class PoolAllocator : public Allocator {
  public:
   PoolAllocator(DeviceHandle device, SystemAllocator* allocator,
                 size_t pool_size)
-    : device_(device), system_allocator(allocator), pool_size_(pool_size) {
+    : device_(device),
+      system_allocator(allocator),
+      pool_size_(pool_size),
+      id_(next_pool_id_++) {
     pool_ = system_allocator->allocate(pool_size_);
+    alignment_ = system_allocator->alignment();
+    usable_size_ = pool_size_ - pool_size_ % alignment_;
+    std::memset(sl_bitmap_, 0, sizeof(sl_bitmap_));
+    std::memset(free_lists_, 0, sizeof(free_lists_));
+
+    Block* block = new_block();
+    block->offset = 0;
+    block->size = usable_size_;
+    insert_free_block(block);
   }
 
   ~PoolAllocator() {
+    {
+      std::lock_guard<std::mutex> registry_guard(thread_cache_registry_lock_);
+      for (auto& cache : thread_caches_) {
+        std::lock_guard<std::mutex> cache_guard(cache->lock);
+        cache->owner = nullptr;
+        for (auto& bin : cache->bins) {
+          bin.clear();
+        }
+      }
+      thread_caches_.clear();
+    }
+    for (Block* block : all_blocks_) {
+      delete block;
+    }
     system_allocator->free(pool_);
   }
 
   u8* allocate(size_t size) {
-    Allocation alloc;
-    alloc.length = size;
-
-    std::lock_guard<std::mutex> guard(lock_);
-    bool found = false;
-    i32 num_alloc = allocations_.size();
-    for (i32 i = 0; i < num_alloc; ++i) {
-      Allocation lower;
-      if (i == 0) {
-        lower.offset = 0;
-        lower.length = 0;
-      } else {
-        lower = allocations_[i - 1];
-      }
-      Allocation higher = allocations_[i];
-      assert(higher.offset >= lower.offset + lower.length);
-      size_t base = align(lower.offset + lower.length);
-      if ((higher.offset - base) >= size) {
-        alloc.offset = base;
-        allocations_.insert(allocations_.begin() + i, alloc);
-        found = true;
-        break;
+    size = align(std::max(size, (size_t)1));
+
+    const std::shared_ptr<ThreadCache>& cache = thread_cache();
+    Block* block = cache->take(size);
+    if (block == nullptr) {
+      std::unique_lock<std::mutex> guard(lock_);
+      block = allocate_block(size);
+      if (block == nullptr) {
+        // Blocks parked in thread caches may be what is missing
+        guard.unlock();
+        flush_thread_caches();
+        guard.lock();
+        block = allocate_block(size);
       }
     }
+    LOG_IF(FATAL, block == nullptr) << "Exceeded pool size";
+    block->cache = cache;
 
-    if (!found) {
-      if (num_alloc > 0) {
-        Allocation& last = allocations_[num_alloc - 1];
-        alloc.offset = align(last.offset + last.length);
-      } else {
-        alloc.offset = 0;
-      }
-      allocations_.push_back(alloc);
+    Shard& shard = shard_for(block->offset);
+    {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      shard.blocks[block->offset] = block;
     }
-
-    LOG_IF(FATAL, alloc.offset + alloc.length >= pool_size_)
-        << "Exceeded pool size";
-
-    u8* buffer = pool_ + alloc.offset;
-    return buffer;
+    num_allocations_++;
+    size_t in_use = (bytes_in_use_ += block->size);
+    size_t high_water = high_water_mark_.load();
+    while (in_use > high_water &&
+           !high_water_mark_.compare_exchange_weak(high_water, in_use)) {
+    }
+    return pool_ + block->offset;
   }
 
   size_t align(size_t ptr) {
@@ -213,101 +250,486 @@ class PoolAllocator : public Allocator {
     LOG_IF(FATAL, !pointer_in_buffer(buffer, pool_, pool_ + pool_size_))
         << "Pool allocator tried to free buffer not in pool";
 
-    std::lock_guard<std::mutex> guard(lock_);
-    i32 index;
-    bool found = find_buffer(buffer, index);
-    LOG_IF(FATAL, !found) << "Attempted to free unallocated buffer in pool";
+    size_t offset = buffer - pool_;
+    Block* block;
+    Shard& shard = shard_for(offset);
+    {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      auto it = shard.blocks.find(offset);
+      LOG_IF(FATAL, it == shard.blocks.end())
+          << "Attempted to free unallocated buffer in pool";
+      block = it->second;
+      shard.blocks.erase(it);
+    }
+    num_allocations_--;
+    bytes_in_use_ -= block->size;
 
-    Allocation& alloc = allocations_[index];
-    allocations_.erase(allocations_.begin() + index);
+    std::shared_ptr<ThreadCache> cache = std::move(block->cache);
+    if (!cache->put(block)) {
+      std::lock_guard<std::mutex> guard(lock_);
+      release_block(block);
+    }
   }
 
- private:
-  bool find_buffer(u8* buffer, i32& index) {
-    i32 num_alloc = allocations_.size();
-    for (i32 i = 0; i < num_alloc; ++i) {
-      Allocation alloc = allocations_[i];
-      if ((size_t)buffer == (size_t)pool_ + alloc.offset) {
-        index = i;
-        return true;
+  void stats(MemoryPoolStats& stats) {
+    stats.pool_size = pool_size_;
+    stats.bytes_in_use = bytes_in_use_;
+    stats.high_water_mark = high_water_mark_;
+    stats.live_allocations = num_allocations_;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t free_bytes = usable_size_ - pool_bytes_in_use_;
+    size_t largest_free_block = 0;
+    if (fl_bitmap_ != 0) {
+      i32 fl = 63 - __builtin_clzll(fl_bitmap_);
+      i32 sl = 31 - __builtin_clz(sl_bitmap_[fl]);
+      for (Block* b = free_lists_[fl][sl]; b != nullptr; b = b->next_free) {
+        largest_free_block = std::max(largest_free_block, b->size);
       }
     }
-    return false;
+    stats.largest_free_block = largest_free_block;
+    stats.fragmentation =
+        free_bytes == 0 ? 0.0 : 1.0 - (f64)largest_free_block / free_bytes;
   }
 
-  typedef struct {
+ private:
+  static const i32 SL_INDEX_COUNT_LOG2 = 5;
+  static const i32 SL_INDEX_COUNT = 1 << SL_INDEX_COUNT_LOG2;
+  static const i32 FL_INDEX_COUNT = 64 - SL_INDEX_COUNT_LOG2;
+  static const i32 NUM_SHARDS = 16;
+  static const i32 THREAD_CACHE_BLOCKS_PER_BIN = 4;
+  static const size_t THREAD_CACHE_MAX_BYTES = 32L * 1024L * 1024L;
+
+  struct ThreadCache;
+
+  struct Block {
     size_t offset;
-    size_t length;
-  } Allocation;
+    size_t size;
+    bool free;
+    Block* prev_phys;
+    Block* next_phys;
+    Block* prev_free;
+    Block* next_free;
+    // Cache of the thread which allocated the block, while it is allocated
+    std::shared_ptr<ThreadCache> cache;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<size_t, Block*> blocks;
+  };
+
+  struct ThreadCache {
+    std::mutex lock;
+    PoolAllocator* owner;
+    std::vector<Block*> bins[FL_INDEX_COUNT];
+    size_t bytes = 0;
+    // Set once the thread has exited, after which blocks freed by other
+    // threads go straight back to the pool
+    bool retired = false;
+
+    // Returns a cached block of at least size bytes which wastes at most an
+    // eighth of the request, or nullptr
+    Block* take(size_t size) {
+      i32 fl, sl;
+      mapping_insert(size, fl, sl);
+      std::lock_guard<std::mutex> guard(lock);
+      std::vector<Block*>& bin = bins[fl];
+      for (size_t i = 0; i < bin.size(); ++i) {
+        Block* block = bin[i];
+        if (block->size >= size && block->size - size <= size / 8) {
+          bin[i] = bin.back();
+          bin.pop_back();
+          bytes -= block->size;
+          return block;
+        }
+      }
+      return nullptr;
+    }
+
+    // Returns false if the cache is full and the block should go back to the
+    // pool
+    bool put(Block* block) {
+      i32 fl, sl;
+      mapping_insert(block->size, fl, sl);
+      std::lock_guard<std::mutex> guard(lock);
+      std::vector<Block*>& bin = bins[fl];
+      if (retired || owner == nullptr ||
+          bin.size() >= THREAD_CACHE_BLOCKS_PER_BIN ||
+          bytes + block->size > THREAD_CACHE_MAX_BYTES) {
+        return false;
+      }
+      bin.push_back(block);
+      bytes += block->size;
+      return true;
+    }
+
+    std::vector<Block*> drain(bool retire = false) {
+      std::vector<Block*> blocks;
+      std::lock_guard<std::mutex> guard(lock);
+      retired = retired || retire;
+      for (auto& bin : bins) {
+        blocks.insert(blocks.end(), bin.begin(), bin.end());
+        bin.clear();
+      }
+      bytes = 0;
+      return blocks;
+    }
+  };
+
+  // Returns the blocks in a thread's caches to their pools when the thread
+  // exits
+  struct ThreadCacheList {
+    std::vector<std::pair<u64, std::shared_ptr<ThreadCache>>> caches;
+
+    ~ThreadCacheList() {
+      std::lock_guard<std::mutex> registry_guard(thread_cache_registry_lock_);
+      for (auto& entry : caches) {
+        std::shared_ptr<ThreadCache>& cache = entry.second;
+        PoolAllocator* owner = cache->owner;
+        if (owner == nullptr) {
+          continue;
+        }
+        std::vector<Block*> blocks = cache->drain(true);
+        std::lock_guard<std::mutex> guard(owner->lock_);
+        for (Block* block : blocks) {
+          owner->release_block(block);
+        }
+        auto& owner_caches = owner->thread_caches_;
+        owner_caches.erase(
+            std::find(owner_caches.begin(), owner_caches.end(), cache));
+      }
+    }
+  };
+
+  static void mapping_insert(size_t size, i32& fl, i32& sl) {
+    if (size < SL_INDEX_COUNT) {
+      fl = 0;
+      sl = (i32)size;
+    } else {
+      i32 t = 63 - __builtin_clzll(size);
+      sl = (i32)(size >> (t - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+      fl = t - SL_INDEX_COUNT_LOG2 + 1;
+    }
+  }
+
+  // Rounds size up to the next size class so that any block in the
+  // resulting class is large enough
+  static void mapping_search(size_t size, i32& fl, i32& sl) {
+    if (size >= SL_INDEX_COUNT) {
+      i32 t = 63 - __builtin_clzll(size);
+      size += ((size_t)1 << (t - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+  }
+
+  const std::shared_ptr<ThreadCache>& thread_cache() {
+    auto& caches = thread_cache_list_.caches;
+    for (auto& entry : caches) {
+      if (entry.first == id_) {
+        return entry.second;
+      }
+    }
+    // First allocation of this thread from a new pool, so drop the caches of
+    // pools which have been destroyed since
+    {
+      std::lock_guard<std::mutex> registry_guard(thread_cache_registry_lock_);
+      auto dead = [](const std::pair<u64, std::shared_ptr<ThreadCache>>& e) {
+        return e.second->owner == nullptr;
+      };
+      caches.erase(std::remove_if(caches.begin(), caches.end(), dead),
+                   caches.end());
+    }
+    std::shared_ptr<ThreadCache> cache(new ThreadCache);
+    cache->owner = this;
+    {
+      std::lock_guard<std::mutex> registry_guard(thread_cache_registry_lock_);
+      thread_caches_.push_back(cache);
+    }
+    caches.emplace_back(id_, cache);
+    return caches.back().second;
+  }
+
+  void flush_thread_caches() {
+    std::lock_guard<std::mutex> registry_guard(thread_cache_registry_lock_);
+    for (auto& cache : thread_caches_) {
+      std::vector<Block*> blocks = cache->drain();
+      std::lock_guard<std::mutex> guard(lock_);
+      for (Block* block : blocks) {
+        release_block(block);
+      }
+    }
+  }
+
+  Shard& shard_for(size_t offset) {
+    return shards_[((offset / alignment_) * 0x9E3779B97F4A7C15ULL) >> 60];
+  }
+
+  // All functions below must be called with lock_ held
+
+  Block* new_block() {
+    Block* block;
+    if (spare_blocks_.empty()) {
+      block = new Block;
+      all_blocks_.push_back(block);
+    } else {
+      block = spare_blocks_.back();
+      spare_blocks_.pop_back();
+    }
+    block->prev_phys = nullptr;
+    block->next_phys = nullptr;
+    block->prev_free = nullptr;
+    block->next_free = nullptr;
+    block->free = false;
+    return block;
+  }
+
+  void insert_free_block(Block* block) {
+    i32 fl, sl;
+    mapping_insert(block->size, fl, sl);
+    block->free = true;
+    block->prev_free = nullptr;
+    block->next_free = free_lists_[fl][sl];
+    if (block->next_free != nullptr) {
+      block->next_free->prev_free = block;
+    }
+    free_lists_[fl][sl] = block;
+    fl_bitmap_ |= (u64)1 << fl;
+    sl_bitmap_[fl] |= (u32)1 << sl;
+  }
+
+  void remove_free_block(Block* block) {
+    i32 fl, sl;
+    mapping_insert(block->size, fl, sl);
+    if (block->prev_free != nullptr) {
+      block->prev_free->next_free = block->next_free;
+    } else {
+      free_lists_[fl][sl] = block->next_free;
+    }
+    if (block->next_free != nullptr) {
+      block->next_free->prev_free = block->prev_free;
+    }
+    if (free_lists_[fl][sl] == nullptr) {
+      sl_bitmap_[fl] &= ~((u32)1 << sl);
+      if (sl_bitmap_[fl] == 0) {
+        fl_bitmap_ &= ~((u64)1 << fl);
+      }
+    }
+    block->free = false;
+  }
+
+  Block* allocate_block(size_t size) {
+    i32 fl, sl;
+    mapping_search(size, fl, sl);
+    if (fl >= FL_INDEX_COUNT) {
+      return nullptr;
+    }
+    u32 sl_map = sl_bitmap_[fl] & (~(u32)0 << sl);
+    if (sl_map == 0) {
+      u64 fl_map = fl_bitmap_ & (~(u64)0 << (fl + 1));
+      if (fl_map == 0) {
+        return nullptr;
+      }
+      fl = __builtin_ctzll(fl_map);
+      sl_map = sl_bitmap_[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    Block* block = free_lists_[fl][sl];
+    assert(block != nullptr && block->size >= size);
+    remove_free_block(block);
+
+    // Return the tail of the block to the pool if it is large enough to be
+    // useful
+    if (block->size - size >= alignment_) {
+      Block* remainder = new_block();
+      remainder->offset = block->offset + size;
+      remainder->size = block->size - size;
+      remainder->prev_phys = block;
+      remainder->next_phys = block->next_phys;
+      if (block->next_phys != nullptr) {
+        block->next_phys->prev_phys = remainder;
+      }
+      block->next_phys = remainder;
+      block->size = size;
+      insert_free_block(remainder);
+    }
+    pool_bytes_in_use_ += block->size;
+    return block;
+  }
+
+  void release_block(Block* block) {
+    pool_bytes_in_use_ -= block->size;
+    Block* prev = block->prev_phys;
+    if (prev != nullptr && prev->free) {
+      remove_free_block(prev);
+      prev->size += block->size;
+      prev->next_phys = block->next_phys;
+      if (block->next_phys != nullptr) {
+        block->next_phys->prev_phys = prev;
+      }
+      spare_blocks_.push_back(block);
+      block = prev;
+    }
+    Block* next = block->next_phys;
+    if (next != nullptr && next->free) {
+      remove_free_block(next);
+      block->size += next->size;
+      block->next_phys = next->next_phys;
+      if (next->next_phys != nullptr) {
+        next->next_phys->prev_phys = block;
+      }
+      spare_blocks_.push_back(next);
+    }
+    insert_free_block(block);
+  }
 
   DeviceHandle device_;
   u8* pool_ = nullptr;
   size_t pool_size_;
+  size_t usable_size_;
+  size_t alignment_;
+
   std::mutex lock_;
-  std::vector<Allocation> allocations_;
+  u64 fl_bitmap_ = 0;
+  u32 sl_bitmap_[FL_INDEX_COUNT];
+  Block* free_lists_[FL_INDEX_COUNT][SL_INDEX_COUNT];
+  std::vector<Block*> all_blocks_;
+  std::vector<Block*> spare_blocks_;
+  size_t pool_bytes_in_use_ = 0;
+
+  Shard shards_[NUM_SHARDS];
+
+  // Unique across the lifetime of the process so that thread caches of a
+  // destroyed pool are never mistaken for those of a new one
+  u64 id_;
+  std::vector<std::shared_ptr<ThreadCache>> thread_caches_;
+  static std::atomic<u64> next_pool_id_;
+  static std::mutex thread_cache_registry_lock_;
+  static thread_local ThreadCacheList thread_cache_list_;
+
+  std::atomic<i64> num_allocations_{0};
+  std::atomic<size_t> bytes_in_use_{0};
+  std::atomic<size_t> high_water_mark_{0};
 
   SystemAllocator* system_allocator;
 };
 
+std::atomic<u64> PoolAllocator::next_pool_id_{0};
+std::mutex PoolAllocator::thread_cache_registry_lock_;
+thread_local PoolAllocator::ThreadCacheList PoolAllocator::thread_cache_list_;
+
+// Tracks blocks of memory which are shared by several elements and frees each
+// block once all of its elements have been freed. Blocks are kept in ordered
+// interval indices, sharded by address region, so that finding the block
+// containing a pointer is O(log n) and only contends with operations on
+// nearby addresses.
 class BlockAllocator {
  public:
   BlockAllocator(Allocator* allocator) : allocator_(allocator) {}
 
   ~BlockAllocator() {
-    std::lock_guard<std::mutex> guard(lock_);
-
-    for (Allocation& alloc : allocations_) {
-      assert(alloc.refs > 0);
-      allocator_->free(alloc.buffer);
+    std::set<Allocation*> allocations;
+    for (Shard& shard : shards_) {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      for (auto& kv : shard.allocations) {
+        allocations.insert(kv.second);
+      }
+    }
+    for (Allocation* alloc : allocations) {
+      assert(alloc->refs > 0);
+      release(alloc);
     }
   }
 
   u8* allocate(size_t size, i32 refs) {
     u8* buffer = allocator_->allocate(size);
 
-    Allocation alloc;
-    alloc.buffer = buffer;
-    alloc.size = size;
-    alloc.refs = refs;
+    Allocation* alloc = new Allocation;
+    alloc->buffer = buffer;
+    alloc->size = size;
+    alloc->refs = refs;
 
-    std::lock_guard<std::mutex> guard(lock_);
-    allocations_.push_back(alloc);
+    for_each_shard(alloc, [alloc](Shard& shard) {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      shard.allocations[alloc->buffer] = alloc;
+    });
 
     return buffer;
   }
 
-  void free(u8* buffer) {
-    std::lock_guard<std::mutex> guard(lock_);
-
-    i32 index;
-    bool found = find_buffer(buffer, index);
-    LOG_IF(FATAL, !found) << "Block allocator freed non-block buffer";
+  // Tracks memory owned by someone else as a block. on_release is called
+  // instead of freeing the buffer once the last element has been deleted.
+  void adopt(u8* buffer, size_t size, i32 refs,
+             std::function<void()> on_release) {
+    Allocation* alloc = new Allocation;
+    alloc->buffer = buffer;
+    alloc->size = size;
+    alloc->refs = refs;
+    alloc->on_release = std::move(on_release);
+
+    for_each_shard(alloc, [alloc](Shard& shard) {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      shard.allocations[alloc->buffer] = alloc;
+    });
+  }
 
-    Allocation& alloc = allocations_[index];
-    assert(alloc.refs > 0);
-    alloc.refs -= 1;
+  // Increments the refcount of the block containing buffer. Returns false if
+  // buffer is not in a block.
+  bool add_refs_if_in_block(u8* buffer, i32 refs) {
+    Shard& shard = shard_for(buffer);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Allocation* alloc = find_buffer(shard, buffer);
+    if (alloc == nullptr) {
+      return false;
+    }
+    assert(alloc->refs > 0);
+    alloc->refs += refs;
+    return true;
+  }
 
-    if (alloc.refs == 0) {
-      allocator_->free(alloc.buffer);
-      allocations_.erase(allocations_.begin() + index);
-      return;
+  // Decrements the refcount of the block containing buffer and frees the
+  // block when it reaches zero. Returns false if buffer is not in a block.
+  bool free_if_in_block(u8* buffer) {
+    Allocation* alloc;
+    {
+      Shard& shard = shard_for(buffer);
+      std::lock_guard<std::mutex> guard(shard.lock);
+      alloc = find_buffer(shard, buffer);
+      if (alloc == nullptr) {
+        return false;
+      }
+      assert(alloc->refs > 0);
+      if (--alloc->refs > 0) {
+        return true;
+      }
     }
+
+    for_each_shard(alloc, [alloc](Shard& shard) {
+      std::lock_guard<std::mutex> guard(shard.lock);
+      shard.allocations.erase(alloc->buffer);
+    });
+    release(alloc);
+    return true;
+  }
+
+  void free(u8* buffer) {
+    bool found = free_if_in_block(buffer);
+    LOG_IF(FATAL, !found) << "Block allocator freed non-block buffer";
   }
 
   bool buffers_in_same_block(std::vector<u8*> buffers) {
     assert(buffers.size() > 0);
 
-    std::lock_guard<std::mutex> guard(lock_);
-    i32 base_index;
-    bool found = find_buffer(buffers[0], base_index);
-    if (!found) {
+    Shard& shard = shard_for(buffers[0]);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Allocation* alloc = find_buffer(shard, buffers[0]);
+    if (alloc == nullptr) {
       return false;
     }
 
     for (i32 i = 1; i < buffers.size(); ++i) {
-      i32 index;
-      found = find_buffer(buffers[i], index);
-      if (!found || base_index != index) {
+      if (!pointer_in_buffer(buffers[i], alloc->buffer,
+                             alloc->buffer + alloc->size)) {
         return false;
       }
     }
@@ -316,32 +738,74 @@ class BlockAllocator {
   }
 
   bool buffer_in_block(u8* buffer) {
-    std::lock_guard<std::mutex> guard(lock_);
-    i32 index;
-    return find_buffer(buffer, index);
+    Shard& shard = shard_for(buffer);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return find_buffer(shard, buffer) != nullptr;
   }
 
  private:
-  bool find_buffer(u8* buffer, i32& index) {
-    i32 num_alloc = allocations_.size();
-    for (i32 i = 0; i < num_alloc; ++i) {
-      Allocation alloc = allocations_[i];
-      if (pointer_in_buffer(buffer, alloc.buffer, alloc.buffer + alloc.size)) {
-        index = i;
-        return true;
-      }
-    }
-    return false;
-  }
+  // Address regions of 2^REGION_SHIFT bytes are assigned to shards round
+  // robin. A block is indexed in every shard whose regions it overlaps.
+  static const i32 REGION_SHIFT = 26;
+  static const i32 NUM_SHARDS = 16;
 
-  typedef struct {
+  struct Allocation {
     u8* buffer;
     size_t size;
-    i32 refs;
-  } Allocation;
+    // Elements of a block may be freed through different shards
+    std::atomic<i32> refs;
+    // Set for adopted blocks, which were not allocated by allocator_
+    std::function<void()> on_release;
+  };
+
+  void release(Allocation* alloc) {
+    if (alloc->on_release) {
+      alloc->on_release();
+    } else {
+      allocator_->free(alloc->buffer);
+    }
+    delete alloc;
+  }
 
-  std::mutex lock_;
-  std::vector<Allocation> allocations_;
+  struct Shard {
+    std::mutex lock;
+    // Keyed by block start address
+    std::map<u8*, Allocation*> allocations;
+  };
+
+  Shard& shard_for(u8* ptr) {
+    return shards_[((size_t)ptr >> REGION_SHIFT) % NUM_SHARDS];
+  }
+
+  template <typename F>
+  void for_each_shard(Allocation* alloc, F f) {
+    size_t first_region = (size_t)alloc->buffer >> REGION_SHIFT;
+    size_t last_region =
+        ((size_t)alloc->buffer + alloc->size - 1) >> REGION_SHIFT;
+    size_t num_shards =
+        std::min(last_region - first_region + 1, (size_t)NUM_SHARDS);
+    for (size_t i = 0; i < num_shards; ++i) {
+      f(shards_[(first_region + i) % NUM_SHARDS]);
+    }
+  }
+
+  // Blocks never overlap, so the only block which can contain buffer is the
+  // one with the greatest start address not above it. Must be called with the
+  // shard lock held.
+  Allocation* find_buffer(Shard& shard, u8* buffer) {
+    auto it = shard.allocations.upper_bound(buffer);
+    if (it == shard.allocations.begin()) {
+      return nullptr;
+    }
+    --it;
+    Allocation* alloc = it->second;
+    if (pointer_in_buffer(buffer, alloc->buffer, alloc->buffer + alloc->size)) {
+      return alloc;
+    }
+    return nullptr;
+  }
+
+  Shard shards_[NUM_SHARDS];
   Allocator* allocator_;
 };
 
@@ -441,6 +905,20 @@ BlockAllocator* block_allocator_for_device(DeviceHandle device) {
   }
 }
 
+bool memory_pool_stats(DeviceHandle device, MemoryPoolStats& stats) {
+  PoolAllocator* allocator = nullptr;
+  if (device.type == DeviceType::CPU) {
+    allocator = cpu_pool_allocator;
+  } else if (gpu_pool_allocators.count(device.id) > 0) {
+    allocator = gpu_pool_allocators.at(device.id);
+  }
+  if (allocator == nullptr) {
+    return false;
+  }
+  allocator->stats(stats);
+  return true;
+}
+
 u8* new_buffer(DeviceHandle device, size_t size) {
   assert(size > 0);
   SystemAllocator* allocator = system_allocator_for_device(device);
@@ -453,12 +931,23 @@ u8* new_block_buffer(DeviceHandle device, size_t size, i32 refs) {
   return allocator->allocate(size, refs);
 }
 
+void adopt_block_buffer(DeviceHandle device, u8* buffer, size_t size,
+                        i32 refs, std::function<void()> on_release) {
+  assert(size > 0);
+  BlockAllocator* allocator = block_allocator_for_device(device);
+  allocator->adopt(buffer, size, refs, std::move(on_release));
+}
+
+bool add_block_buffer_refs(DeviceHandle device, u8* buffer, i32 refs) {
+  assert(buffer != nullptr);
+  BlockAllocator* allocator = block_allocator_for_device(device);
+  return allocator->add_refs_if_in_block(buffer, refs);
+}
+
 void delete_buffer(DeviceHandle device, u8* buffer) {
   assert(buffer != nullptr);
   BlockAllocator* block_allocator = block_allocator_for_device(device);
-  if (block_allocator->buffer_in_block(buffer)) {
-    block_allocator->free(buffer);
-  } else {
+  if (!block_allocator->free_if_in_block(buffer)) {
     SystemAllocator* system_allocator = system_allocator_for_device(device);
     system_allocator->free(buffer);
   }
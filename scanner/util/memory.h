@@ -18,6 +18,7 @@
 #include "scanner/util/common.h"
 
 #include <cstddef>
+#include <functional>
 
 namespace scanner {
 
@@ -28,10 +29,35 @@ void init_memory_allocators(MemoryPoolConfig config,
 
 void destroy_memory_allocators();
 
+struct MemoryPoolStats {
+  size_t pool_size;
+  size_t bytes_in_use;
+  // Largest number of bytes in use at once since the pool was created
+  size_t high_water_mark;
+  size_t largest_free_block;
+  // 1 - largest_free_block / free bytes. 0 means all free space is contiguous.
+  f64 fragmentation;
+  i64 live_allocations;
+};
+
+// Returns false if the device is not backed by a memory pool
+bool memory_pool_stats(DeviceHandle device, MemoryPoolStats& stats);
+
 u8* new_buffer(DeviceHandle device, size_t size);
 
 u8* new_block_buffer(DeviceHandle device, size_t size, i32 refs);
 
+// Lets memory which scanner did not allocate, such as a file mapping, be
+// handed out as a block of refs elements. Elements are deleted with
+// delete_buffer as usual and on_release is called after the last one.
+void adopt_block_buffer(DeviceHandle device, u8* buffer, size_t size,
+                        i32 refs, std::function<void()> on_release);
+
+// Shares the block containing buffer between refs more elements, each of
+// which is deleted with delete_buffer. Returns false if buffer is not in a
+// block.
+bool add_block_buffer_refs(DeviceHandle device, u8* buffer, i32 refs);
+
 void delete_buffer(DeviceHandle device, u8* buffer);
 
 void memcpy_buffer(u8* dest_buffer, DeviceHandle dest_device,
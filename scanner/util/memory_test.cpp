@@ -0,0 +1,265 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/memory.h"
+#include "scanner/util/util.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/sysinfo.h>
+#include <random>
+#include <thread>
+
+namespace scanner {
+namespace {
+
+const size_t TEST_POOL_SIZE = 256L * 1024L * 1024L;
+
+void init_cpu_pool() {
+  struct sysinfo info;
+  ASSERT_EQ(sysinfo(&info), 0);
+  MemoryPoolConfig config;
+  config.mutable_cpu()->set_use_pool(true);
+  config.mutable_cpu()->set_free_space(info.totalram - TEST_POOL_SIZE);
+  init_memory_allocators(config, {});
+}
+
+// Allocates num_blocks block buffers of elements_per_block elements each
+std::vector<std::vector<u8*>> make_block_elements(i32 num_blocks,
+                                                  i32 elements_per_block) {
+  const size_t element_size = 64;
+  std::vector<std::vector<u8*>> elements(num_blocks);
+  for (i32 b = 0; b < num_blocks; ++b) {
+    u8* block = new_block_buffer(CPU_DEVICE, element_size * elements_per_block,
+                                 elements_per_block);
+    for (i32 e = 0; e < elements_per_block; ++e) {
+      elements[b].push_back(block + e * element_size);
+    }
+  }
+  return elements;
+}
+}
+
+TEST(PoolAllocator, AllocateAndFree) {
+  init_cpu_pool();
+
+  MemoryPoolStats stats;
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.pool_size, TEST_POOL_SIZE);
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.fragmentation, 0.0);
+
+  std::vector<u8*> buffers;
+  size_t total_size = 0;
+  for (i32 i = 1; i <= 64; ++i) {
+    size_t size = i * 1000;
+    u8* buffer = new_block_buffer(CPU_DEVICE, size, 1);
+    memset(buffer, i, size);
+    buffers.push_back(buffer);
+    total_size += size;
+  }
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.live_allocations, 64);
+  EXPECT_GE(stats.bytes_in_use, total_size);
+
+  // Punch holes into the pool
+  for (i32 i = 0; i < 64; i += 2) {
+    delete_buffer(CPU_DEVICE, buffers[i]);
+  }
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_GT(stats.fragmentation, 0.0);
+  for (i32 i = 1; i < 64; i += 2) {
+    for (i32 j = 0; j < (i + 1) * 1000; ++j) {
+      ASSERT_EQ(buffers[i][j], i + 1);
+    }
+    delete_buffer(CPU_DEVICE, buffers[i]);
+  }
+
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.live_allocations, 0);
+  EXPECT_GE(stats.high_water_mark, total_size);
+  destroy_memory_allocators();
+}
+
+TEST(PoolAllocator, ExhaustAndReuse) {
+  init_cpu_pool();
+
+  // Filling the whole pool twice only works if freed space is reclaimed,
+  // including blocks parked in thread caches
+  const size_t size = 16L * 1024L * 1024L;
+  for (i32 round = 0; round < 2; ++round) {
+    std::vector<u8*> buffers;
+    for (size_t i = 0; i < TEST_POOL_SIZE / size; ++i) {
+      buffers.push_back(new_block_buffer(CPU_DEVICE, size, 1));
+    }
+    for (u8* buffer : buffers) {
+      delete_buffer(CPU_DEVICE, buffer);
+    }
+  }
+  std::vector<u8*> buffers;
+  for (size_t i = 0; i < TEST_POOL_SIZE / (size / 2); ++i) {
+    buffers.push_back(new_block_buffer(CPU_DEVICE, size / 2, 1));
+  }
+  for (u8* buffer : buffers) {
+    delete_buffer(CPU_DEVICE, buffer);
+  }
+  destroy_memory_allocators();
+}
+
+TEST(PoolAllocator, ConcurrentAllocations) {
+  init_cpu_pool();
+
+  std::vector<std::thread> threads;
+  for (i32 t = 0; t < 8; ++t) {
+    threads.emplace_back([t]() {
+      std::mt19937 gen(t);
+      std::uniform_int_distribution<size_t> dist(1, 256 * 1024);
+      std::vector<std::tuple<u8*, size_t>> live;
+      for (i32 i = 0; i < 5000; ++i) {
+        if (live.size() < 16) {
+          size_t size = dist(gen);
+          u8* buffer = new_block_buffer(CPU_DEVICE, size, 1);
+          memset(buffer, t, size);
+          live.emplace_back(buffer, size);
+        } else {
+          size_t idx = dist(gen) % live.size();
+          u8* buffer;
+          size_t size;
+          std::tie(buffer, size) = live[idx];
+          for (size_t j = 0; j < size; j += 97) {
+            ASSERT_EQ(buffer[j], t);
+          }
+          delete_buffer(CPU_DEVICE, buffer);
+          live.erase(live.begin() + idx);
+        }
+      }
+      for (auto& entry : live) {
+        delete_buffer(CPU_DEVICE, std::get<0>(entry));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  MemoryPoolStats stats;
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.live_allocations, 0);
+  destroy_memory_allocators();
+}
+
+TEST(PoolAllocator, BlocksFreedElsewhereReturnToAllocatingThread) {
+  init_cpu_pool();
+
+  // Frames are allocated by decode threads and freed by later stages
+  const size_t size = 1024 * 1024;
+  u8* buffer = new_block_buffer(CPU_DEVICE, size, 1);
+  std::thread([buffer]() { delete_buffer(CPU_DEVICE, buffer); }).join();
+  u8* reused = new_block_buffer(CPU_DEVICE, size, 1);
+  EXPECT_EQ(reused, buffer);
+  delete_buffer(CPU_DEVICE, reused);
+
+  // Blocks freed after their allocating thread exited go back to the pool
+  std::thread([&buffer, size]() {
+    buffer = new_block_buffer(CPU_DEVICE, size, 1);
+  }).join();
+  delete_buffer(CPU_DEVICE, buffer);
+  MemoryPoolStats stats;
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  // Only the first buffer is still parked in this thread's cache
+  EXPECT_GT(stats.largest_free_block, TEST_POOL_SIZE - 2 * size);
+  destroy_memory_allocators();
+}
+
+TEST(BlockAllocator, InterleavedFreesReleaseEachBlockOnce) {
+  init_cpu_pool();
+
+  // Freed in an interleaved order so that lookups are spread over all live
+  // blocks
+  const i32 num_blocks = 40;
+  const i32 elements_per_block = 25;
+  auto elements = make_block_elements(num_blocks, elements_per_block);
+  MemoryPoolStats stats;
+  for (i32 e = 0; e < elements_per_block; ++e) {
+    for (i32 b = 0; b < num_blocks; ++b) {
+      delete_buffer(CPU_DEVICE, elements[b][e]);
+    }
+    ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+    EXPECT_EQ(stats.live_allocations,
+              e + 1 < elements_per_block ? num_blocks : 0);
+  }
+  destroy_memory_allocators();
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(BlockAllocator, DISABLED_FreeManyElements) {
+  init_cpu_pool();
+
+  // 400 work items of 250 elements each
+  const i32 num_blocks = 400;
+  const i32 elements_per_block = 250;
+  auto elements = make_block_elements(num_blocks, elements_per_block);
+  auto start = now();
+  for (i32 e = 0; e < elements_per_block; ++e) {
+    for (i32 b = 0; b < num_blocks; ++b) {
+      delete_buffer(CPU_DEVICE, elements[b][e]);
+    }
+  }
+  f64 seconds = nano_since(start) / 1e9;
+  std::cout << "Freed " << num_blocks * elements_per_block << " elements in "
+            << seconds << " s" << std::endl;
+  destroy_memory_allocators();
+}
+
+TEST(BlockAllocator, AdoptedBlocksAreReleasedByLastElement) {
+  init_cpu_pool();
+
+  std::vector<u8> memory(1000);
+  i32 releases = 0;
+  adopt_block_buffer(CPU_DEVICE, memory.data(), memory.size(), 3,
+                     [&]() { releases++; });
+  delete_buffer(CPU_DEVICE, memory.data() + 999);
+  delete_buffer(CPU_DEVICE, memory.data());
+  EXPECT_EQ(releases, 0);
+  delete_buffer(CPU_DEVICE, memory.data() + 500);
+  EXPECT_EQ(releases, 1);
+
+  // Adopted memory never comes out of the pool
+  MemoryPoolStats stats;
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.live_allocations, 0);
+  destroy_memory_allocators();
+}
+
+TEST(BlockAllocator, AddedRefsKeepBlockAlive) {
+  init_cpu_pool();
+
+  u8* block = new_block_buffer(CPU_DEVICE, 1000, 1);
+  ASSERT_TRUE(add_block_buffer_refs(CPU_DEVICE, block + 100, 2));
+  delete_buffer(CPU_DEVICE, block);
+  delete_buffer(CPU_DEVICE, block + 500);
+
+  MemoryPoolStats stats;
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.live_allocations, 1);
+  delete_buffer(CPU_DEVICE, block + 999);
+  ASSERT_TRUE(memory_pool_stats(CPU_DEVICE, stats));
+  EXPECT_EQ(stats.live_allocations, 0);
+  destroy_memory_allocators();
+}
+}
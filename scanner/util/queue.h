@@ -15,13 +15,47 @@
 
 #pragma once
 
+#include "scanner/util/common.h"
+
+#include <algorithm>
 #include <atomic>
-#include <condition_variable>
-#include <deque>
-#include <mutex>
+#include <memory>
 
 namespace scanner {
 
+namespace internal {
+
+// Parks threads on a futex until another thread signals that the condition
+// they are waiting for may have changed. Waiters call prepare_wait, re-check
+// their condition and then either cancel_wait or wait. Signalling is free
+// when nobody is parked.
+class EventCount {
+ public:
+  i32 prepare_wait();
+
+  void cancel_wait();
+
+  void wait(i32 key);
+
+  void notify_one();
+
+  void notify_all();
+
+  i32 waiters() const;
+
+ private:
+  void notify(i32 count);
+
+  std::atomic<i32> epoch_{0};
+  std::atomic<i32> waiters_{0};
+};
+}
+
+// Bounded multi-producer multi-consumer queue. Elements live in a ring buffer
+// of sequenced cells so that producers and consumers only contend on a single
+// atomic counter each. Threads only park when the queue is actually full
+// (push) or empty (pop). The ring needs at least two cells to tell a full
+// cell from an empty one, so max_size is rounded up to 2.
 template <typename T>
 class Queue {
  public:
@@ -39,18 +73,33 @@ class Queue {
 
   void pop(T& item);
 
+  // Only safe when there is a single consumer
   void peek(T& item);
 
   void clear();
 
  private:
+  static const size_t CACHE_LINE_SIZE = 64;
+
+  struct Cell {
+    std::atomic<u64> sequence;
+    T data;
+  };
+
+  bool try_push_impl(T& item);
+
+  bool try_pop_impl(T& item);
+
   i32 max_size_;
-  std::mutex mutex_;
-  std::condition_variable not_empty_;
-  std::condition_variable not_full_;
-  std::deque<T> data_;
-  std::atomic<int> pop_waiters_{0};
-  std::atomic<int> push_waiters_{0};
+  std::unique_ptr<Cell[]> cells_;
+  char pad0_[CACHE_LINE_SIZE];
+  std::atomic<u64> enqueue_pos_{0};
+  char pad1_[CACHE_LINE_SIZE];
+  std::atomic<u64> dequeue_pos_{0};
+  char pad2_[CACHE_LINE_SIZE];
+  internal::EventCount not_empty_;
+  char pad3_[CACHE_LINE_SIZE];
+  internal::EventCount not_full_;
 };
 }
 
@@ -15,98 +15,191 @@
 
 #include "queue.h"
 
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+
 namespace scanner {
 
+namespace internal {
+
+inline i32 EventCount::prepare_wait() {
+  waiters_.fetch_add(1, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return epoch_.load(std::memory_order_acquire);
+}
+
+inline void EventCount::cancel_wait() {
+  waiters_.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+inline void EventCount::wait(i32 key) {
+  while (epoch_.load(std::memory_order_acquire) == key) {
+    syscall(SYS_futex, reinterpret_cast<i32*>(&epoch_), FUTEX_WAIT_PRIVATE,
+            key, nullptr, nullptr, 0);
+  }
+  waiters_.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+inline void EventCount::notify_one() { notify(1); }
+
+inline void EventCount::notify_all() { notify(INT_MAX); }
+
+inline i32 EventCount::waiters() const {
+  return waiters_.load(std::memory_order_relaxed);
+}
+
+inline void EventCount::notify(i32 count) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  epoch_.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<i32*>(&epoch_), FUTEX_WAKE_PRIVATE,
+          count, nullptr, nullptr, 0);
+}
+}
+
 template <typename T>
 Queue<T>::Queue(i32 max_size)
-    : max_size_(max_size) {}
+    : max_size_(std::max(max_size, 2)), cells_(new Cell[max_size_]) {
+  for (i32 i = 0; i < max_size_; ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
 
 template <typename T>
 Queue<T>::Queue(Queue<T> &&o)
-    : max_size_(o.max_size_), data_(std::move(o.data_)) {}
+    : Queue(o.max_size_) {
+  T item;
+  while (o.try_pop_impl(item)) {
+    try_push_impl(item);
+  }
+}
 
 template <typename T>
 int Queue<T>::size() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  return data_.size() - pop_waiters_ + push_waiters_;
+  i64 size = (i64)(enqueue_pos_.load(std::memory_order_acquire) -
+                   dequeue_pos_.load(std::memory_order_acquire));
+  return std::max(size, (i64)0) - not_empty_.waiters() + not_full_.waiters();
 }
 
 template <typename T>
 template <typename... Args>
 void Queue<T>::emplace(Args&&... args) {
-  std::unique_lock<std::mutex> lock(mutex_);
-  push_waiters_++;
-  not_full_.wait(lock, [this]{ return data_.size() < max_size_; });
-  push_waiters_--;
-  data_.emplace_back(std::forward<Args>(args)...);
-
-  lock.unlock();
-  not_empty_.notify_one();
+  push(T(std::forward<Args>(args)...));
 }
 
 template <typename T>
 void Queue<T>::push(T item) {
-  std::unique_lock<std::mutex> lock(mutex_);
-  push_waiters_++;
-  not_full_.wait(lock, [this]{ return data_.size() < max_size_; });
-  push_waiters_--;
-
-  data_.push_back(item);
-  lock.unlock();
-  // TODO(apoms): check how much overhead this causes. Would it be better to
-  //              check if the deque was empty before and only notify then
-  //              instead of always notifying?
+  while (!try_push_impl(item)) {
+    i32 key = not_full_.prepare_wait();
+    if (try_push_impl(item)) {
+      not_full_.cancel_wait();
+      break;
+    }
+    not_full_.wait(key);
+  }
   not_empty_.notify_one();
 }
 
 template <typename T>
 bool Queue<T>::try_pop(T& item) {
-  std::unique_lock<std::mutex> lock(mutex_);
-  if (data_.empty()) {
+  if (!try_pop_impl(item)) {
     return false;
-  } else {
-    item = data_.front();
-    data_.pop_front();
-
-    lock.unlock();
-    not_full_.notify_one();
-    return true;
   }
+  not_full_.notify_one();
+  return true;
 }
 
 template <typename T>
 void Queue<T>::pop(T& item) {
-  std::unique_lock<std::mutex> lock(mutex_);
-  pop_waiters_++;
-  not_empty_.wait(lock, [this]{ return data_.size() > 0; });
-  pop_waiters_--;
-
-  item = data_.front();
-  data_.pop_front();
-
-  lock.unlock();
+  while (!try_pop_impl(item)) {
+    i32 key = not_empty_.prepare_wait();
+    if (try_pop_impl(item)) {
+      not_empty_.cancel_wait();
+      break;
+    }
+    not_empty_.wait(key);
+  }
   not_full_.notify_one();
 }
 
 template <typename T>
 void Queue<T>::peek(T& item) {
-  std::unique_lock<std::mutex> lock(mutex_);
-  pop_waiters_++;
-  not_empty_.wait(lock, [this]{ return data_.size() > 0; });
-  pop_waiters_--;
-
-  item = data_.front();
-
-  lock.unlock();
+  while (true) {
+    u64 pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell& cell = cells_[pos % max_size_];
+    if (cell.sequence.load(std::memory_order_acquire) == pos + 1) {
+      item = cell.data;
+      return;
+    }
+    i32 key = not_empty_.prepare_wait();
+    if (cell.sequence.load(std::memory_order_acquire) == pos + 1) {
+      not_empty_.cancel_wait();
+      continue;
+    }
+    not_empty_.wait(key);
+  }
 }
 
 template <typename T>
 void Queue<T>::clear() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  data_.clear();
+  T item;
+  while (try_pop_impl(item)) {
+  }
+  not_full_.notify_all();
+}
 
-  lock.unlock();
-  not_full_.notify_one();
+template <typename T>
+bool Queue<T>::try_push_impl(T& item) {
+  Cell* cell;
+  u64 pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos % max_size_];
+    u64 seq = cell->sequence.load(std::memory_order_acquire);
+    i64 diff = (i64)seq - (i64)pos;
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Full
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->data = std::move(item);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+bool Queue<T>::try_pop_impl(T& item) {
+  Cell* cell;
+  u64 pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos % max_size_];
+    u64 seq = cell->sequence.load(std::memory_order_acquire);
+    i64 diff = (i64)seq - (i64)(pos + 1);
+    if (diff == 0) {
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Empty
+      return false;
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  item = std::move(cell->data);
+  cell->sequence.store(pos + max_size_, std::memory_order_release);
+  return true;
 }
 
 }
@@ -0,0 +1,182 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/queue.h"
+#include "scanner/util/util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace scanner {
+namespace {
+
+// The mutex/deque queue that Queue replaced, kept as a baseline for the
+// throughput comparison below
+template <typename T>
+class LockedQueue {
+ public:
+  LockedQueue(i32 max_size) : max_size_(max_size) {}
+
+  void push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return data_.size() < max_size_; });
+    data_.push_back(item);
+    lock.unlock();
+    not_empty_.notify_one();
+  }
+
+  void pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return data_.size() > 0; });
+    item = data_.front();
+    data_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
+  }
+
+ private:
+  size_t max_size_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<T> data_;
+};
+
+// Moves items_per_producer items from each of threads producers to as many
+// consumers through a queue of type Q. Returns the items received by each
+// consumer.
+template <typename Q = Queue<i64>>
+std::vector<std::vector<i64>> run_producers_consumers(i32 threads,
+                                                      i64 items_per_producer) {
+  Q queue(4);
+  std::vector<std::vector<i64>> received(threads);
+  std::vector<std::thread> producers;
+  std::vector<std::thread> consumers;
+  for (i32 t = 0; t < threads; ++t) {
+    producers.emplace_back([&, t]() {
+      for (i64 i = 0; i < items_per_producer; ++i) {
+        queue.push(t * items_per_producer + i);
+      }
+    });
+    consumers.emplace_back([&, t]() {
+      received[t].reserve(items_per_producer);
+      for (i64 i = 0; i < items_per_producer; ++i) {
+        i64 item;
+        queue.pop(item);
+        received[t].push_back(item);
+      }
+    });
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  for (auto& t : consumers) {
+    t.join();
+  }
+  return received;
+}
+}
+
+TEST(Queue, PushPopOrder) {
+  Queue<i32> queue(3);
+  queue.push(1);
+  queue.push(2);
+  queue.emplace(3);
+  EXPECT_EQ(queue.size(), 3);
+  i32 item;
+  queue.peek(item);
+  EXPECT_EQ(item, 1);
+  for (i32 i = 1; i <= 3; ++i) {
+    queue.pop(item);
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_FALSE(queue.try_pop(item));
+  EXPECT_EQ(queue.size(), 0);
+}
+
+TEST(Queue, ClearUnblocksProducer) {
+  Queue<i32> queue(2);
+  queue.push(1);
+  queue.push(2);
+  std::thread producer([&]() { queue.push(3); });
+  while (queue.size() < 3) {
+    std::this_thread::yield();
+  }
+  queue.clear();
+  producer.join();
+  i32 item;
+  queue.pop(item);
+  EXPECT_EQ(item, 3);
+}
+
+TEST(Queue, MoveOnlyItems) {
+  Queue<std::unique_ptr<i32>> queue(2);
+  queue.push(std::unique_ptr<i32>(new i32(7)));
+  std::unique_ptr<i32> item;
+  queue.pop(item);
+  ASSERT_TRUE(item);
+  EXPECT_EQ(*item, 7);
+}
+
+TEST(Queue, ConcurrentItemsArriveOnceInOrder) {
+  const i32 threads = 4;
+  const i64 items_per_producer = 20000;
+  auto received = run_producers_consumers(threads, items_per_producer);
+  std::vector<i64> all;
+  for (auto& items : received) {
+    // Items of one producer reach each consumer in the order they were pushed
+    std::vector<i64> last(threads, -1);
+    for (i64 item : items) {
+      i64 producer = item / items_per_producer;
+      ASSERT_GT(item, last[producer]);
+      last[producer] = item;
+    }
+    all.insert(all.end(), items.begin(), items.end());
+  }
+  std::sort(all.begin(), all.end());
+  ASSERT_EQ(all.size(), threads * items_per_producer);
+  for (size_t i = 0; i < all.size(); ++i) {
+    ASSERT_EQ(all[i], (i64)i);
+  }
+}
+
+// Compares Queue with the mutex/deque queue it replaced. Run with
+// --gtest_also_run_disabled_tests
+TEST(Queue, DISABLED_Throughput) {
+  const i64 items = 2000000;
+  auto items_per_second = [&](std::function<void()> run) {
+    auto start = now();
+    run();
+    return items / (nano_since(start) / 1e9);
+  };
+  for (i32 threads : {1, 4, 16}) {
+    f64 locked = items_per_second([&]() {
+      run_producers_consumers<LockedQueue<i64>>(threads, items / threads);
+    });
+    f64 lock_free = items_per_second([&]() {
+      run_producers_consumers<Queue<i64>>(threads, items / threads);
+    });
+    std::cout << threads << " producers/" << threads << " consumers: "
+              << "mutex/deque " << locked << " items/s, "
+              << "lock-free " << lock_free << " items/s" << std::endl;
+  }
+}
+}
@@ -22,6 +22,7 @@
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <atomic>
 #include <chrono>
@@ -55,6 +56,15 @@ inline double nano_since(timepoint_t then) {
       .count();
 }
 
+// CPU time consumed so far by the calling thread (or by the whole process)
+inline int64_t cpu_nanos(bool whole_process = false) {
+  timespec spec;
+  clock_gettime(whole_process ? CLOCK_PROCESS_CPUTIME_ID
+                              : CLOCK_THREAD_CPUTIME_ID,
+                &spec);
+  return (int64_t)spec.tv_sec * 1000000000 + spec.tv_nsec;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// String processing
 inline void split(const std::string& s, char delim,
@@ -19,10 +19,35 @@
 #include "scanner/util/h264.h"
 #include "scanner/util/memory.h"
 
+#include <algorithm>
 #include <thread>
 
 namespace scanner {
 namespace internal {
+namespace {
+
+// A frame can be dropped before decoding if it is not requested and no
+// other frame uses it as a reference
+bool is_droppable_frame(const proto::DecodeArgs& args, i64 frame,
+                        i64 next_valid_frame) {
+  if (args.keyframes_only()) {
+    return frame != next_valid_frame;
+  }
+  i64 idx = frame - args.start_keyframe();
+  return frame != next_valid_frame && idx >= 0 &&
+         idx < args.reference_frames_size() && !args.reference_frames(idx);
+}
+
+// Number of the frame stored after the given one in the encoded video
+i64 next_frame_number(const proto::DecodeArgs& args, i64 frame) {
+  if (!args.keyframes_only()) {
+    return frame + 1;
+  }
+  auto it = std::upper_bound(args.keyframes().begin(), args.keyframes().end(),
+                             frame);
+  return it == args.keyframes().end() ? frame + 1 : *it;
+}
+}
 
 DecoderAutomata::DecoderAutomata(DeviceHandle device_handle, i32 num_devices,
                                  VideoDecoderType decoder_type)
@@ -40,8 +65,12 @@ DecoderAutomata::DecoderAutomata(DeviceHandle device_handle, i32 num_devices,
 
 DecoderAutomata::~DecoderAutomata() {
   {
-    frames_to_get_ = 0;
-    frames_retrieved_ = 0;
+    {
+      std::unique_lock<std::mutex> lk(feeder_mutex_);
+      frames_to_get_ = 0;
+      frames_retrieved_ = 0;
+    }
+    wake_feeder_.notify_all();
     while (decoder_->discard_frame()) {
     }
 
@@ -55,7 +84,7 @@ DecoderAutomata::~DecoderAutomata() {
     feeder_waiting_ = false;
   }
 
-  wake_feeder_.notify_one();
+  wake_feeder_.notify_all();
   feeder_thread_.join();
 
   for (auto& args : encoded_data_) {
@@ -66,8 +95,16 @@ DecoderAutomata::~DecoderAutomata() {
 void DecoderAutomata::initialize(
     const std::vector<proto::DecodeArgs>& encoded_data) {
   assert(!encoded_data.empty());
-  encoded_data_ = encoded_data;
-  frame_size_ = encoded_data[0].width() * encoded_data[0].height() * 3;
+  initialize(encoded_data, FrameInfo(encoded_data[0].height(),
+                                     encoded_data[0].width(), 3,
+                                     FrameType::U8));
+}
+
+void DecoderAutomata::initialize(
+    const std::vector<proto::DecodeArgs>& encoded_data,
+    const FrameInfo& output_info) {
+  assert(!encoded_data.empty());
+  frame_size_ = output_info.size();
   current_frame_ = encoded_data[0].start_keyframe();
   next_frame_.store(encoded_data[0].valid_frames(0), std::memory_order_release);
   retriever_data_idx_.store(0, std::memory_order_release);
@@ -82,8 +119,20 @@ void DecoderAutomata::initialize(
   std::unique_lock<std::mutex> lk(feeder_mutex_);
   wake_feeder_.wait(lk, [this] { return feeder_waiting_.load(); });
 
+  // The feeder is done with the previous encoded data
+  for (auto& args : encoded_data_) {
+    delete_buffer(CPU_DEVICE, (u8*)args.encoded_video());
+  }
+  encoded_data_ = encoded_data;
+
   if (info_ != info) {
     decoder_->configure(info);
+    output_info_ = info;
+  }
+  if (output_info_ != output_info) {
+    assert(decoder_->can_convert_frames());
+    decoder_->set_output_format(output_info);
+    output_info_ = output_info;
   }
   if (frames_retrieved_ > 0) {
     decoder_->feed(nullptr, 0, true);
@@ -100,6 +149,7 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
   i64 total_frames_used = 0;
 
   auto start = now();
+  i64 cpu_start = cpu_nanos();
 
   // Wait until feeder is waiting
   {
@@ -108,7 +158,11 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
     wake_feeder_.wait(lk, [this] { return feeder_waiting_.load(); });
   }
 
-  if (encoded_data_.size() > feeder_data_idx_) {
+  // The feeder stops at the end of each decode args. If frames of those args
+  // are still buffered, resetting the decoder now would drop them, so the
+  // feeder is restarted below once the retriever moves on to the next args.
+  bool restart_feeder = retriever_data_idx_ >= feeder_data_idx_;
+  if (restart_feeder && encoded_data_.size() > feeder_data_idx_) {
     // Make sure to not feed seek packet if we reached end of stream
     if (seeking_) {
       decoder_->feed(nullptr, 0, true);
@@ -121,16 +175,22 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
     std::unique_lock<std::mutex> lk(feeder_mutex_);
     frames_retrieved_ = 0;
     frames_to_get_ = num_frames;
-    feeder_waiting_ = false;
+    feeder_waiting_ = !restart_feeder;
   }
-  wake_feeder_.notify_one();
+  wake_feeder_.notify_all();
 
   if (profiler_) {
     profiler_->add_interval("get_frames_wait", start, now());
   }
 
   while (frames_retrieved_ < frames_to_get_) {
-    if (decoder_->decoded_frames_buffered() > 0) {
+    {
+      // Wait for the feeder to decode more frames
+      std::unique_lock<std::mutex> lk(feeder_mutex_);
+      wake_feeder_.wait(
+          lk, [this] { return decoder_->decoded_frames_buffered() > 0; });
+    }
+    {
       auto iter = now();
       // New frames
       bool more_frames = true;
@@ -159,6 +219,9 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
                   while (decoder_->discard_frame()) {
                     total_frames_decoded++;
                   }
+                  // The feeder may be waiting for these frames to be
+                  // consumed before it can finish the decode args
+                  wake_feeder_.notify_all();
                   return feeder_waiting_.load();
                 });
                 // skip_frames_ = false;
@@ -175,7 +238,7 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
                 current_frame_ =
                     encoded_data_[retriever_data_idx_].keyframes(0) - 1;
               }
-              wake_feeder_.notify_one();
+              wake_feeder_.notify_all();
               more_frames = false;
             } else {
               assert(frames_retrieved_ + 1 == frames_to_get_);
@@ -192,22 +255,33 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
         } else {
           more_frames = decoder_->discard_frame();
         }
-        current_frame_++;
         total_frames_decoded++;
+        if (retriever_data_idx_ < encoded_data_.size()) {
+          const proto::DecodeArgs& da = encoded_data_[retriever_data_idx_];
+          current_frame_ = next_frame_number(da, current_frame_);
+          // Step over the frames the feeder did not hand to the decoder
+          while (is_droppable_frame(
+              da, current_frame_, da.valid_frames(retriever_valid_idx_))) {
+            current_frame_ = next_frame_number(da, current_frame_);
+          }
+        } else {
+          current_frame_++;
+        }
         // printf("curr frame %d, frames decoded %d\n", current_frame_,
         //        total_frames_decoded);
+        notify_frames_changed();
       }
       if (profiler_) {
         profiler_->add_interval("iter", iter, now());
       }
     }
-    std::this_thread::yield();
   }
   decoder_->wait_until_frames_copied();
   if (profiler_) {
     profiler_->add_interval("get_frames", start, now());
     profiler_->increment("frames_used", total_frames_used);
     profiler_->increment("frames_decoded", total_frames_decoded);
+    profiler_->increment("decode_thread_cpu_ns", cpu_nanos() - cpu_start);
   }
 }
 
@@ -220,6 +294,7 @@ void DecoderAutomata::feeder() {
   // printf("feeder start\n");
   i64 total_frames_fed = 0;
   i32 frames_fed = 0;
+  i32 frames_dropped = 0;
   seeking_ = false;
   while (not_done_) {
     {
@@ -227,7 +302,7 @@ void DecoderAutomata::feeder() {
       std::unique_lock<std::mutex> lk(feeder_mutex_);
       feeder_waiting_ = true;
     }
-    wake_feeder_.notify_one();
+    wake_feeder_.notify_all();
 
     {
       std::unique_lock<std::mutex> lk(feeder_mutex_);
@@ -242,15 +317,20 @@ void DecoderAutomata::feeder() {
 
     if (profiler_) {
       profiler_->increment("frames_fed", frames_fed);
+      profiler_->increment("frames_dropped", frames_dropped);
     }
     frames_fed = 0;
+    frames_dropped = 0;
+    i64 cpu_start = cpu_nanos();
     bool seen_metadata = false;
     while (frames_retrieved_ < frames_to_get_) {
-      i32 frames_to_wait = 8;
-      while (frames_retrieved_ < frames_to_get_ &&
-             decoder_->decoded_frames_buffered() > frames_to_wait) {
-        wake_feeder_.notify_one();
-        std::this_thread::yield();
+      {
+        // Wait until the retriever has consumed enough of the buffered frames
+        std::unique_lock<std::mutex> lk(feeder_mutex_);
+        wake_feeder_.wait(lk, [this] {
+          return frames_retrieved_ >= frames_to_get_ ||
+                 decoder_->decoded_frames_buffered() <= MAX_BUFFERED_FRAMES;
+        });
       }
       if (skip_frames_) {
         seen_metadata = false;
@@ -258,7 +338,6 @@ void DecoderAutomata::feeder() {
         set_feeder_idx(feeder_data_idx_ + 1);
         break;
       }
-      frames_fed++;
 
       i32 fdi = feeder_data_idx_.load(std::memory_order_acquire);
       const u8* encoded_buffer = (const u8*)encoded_data_[fdi].encoded_video();
@@ -298,7 +377,15 @@ void DecoderAutomata::feeder() {
         }
       }
 
-      decoder_->feed(encoded_packet, encoded_packet_size, false);
+      if (encoded_packet_size > 0 &&
+          is_droppable_frame(encoded_data_[fdi], feeder_current_frame_,
+                             feeder_next_frame_)) {
+        frames_dropped++;
+      } else {
+        decoder_->feed(encoded_packet, encoded_packet_size, false);
+        frames_fed++;
+        notify_frames_changed();
+      }
 
       if (feeder_current_frame_ == feeder_next_frame_) {
         feeder_valid_idx_++;
@@ -311,7 +398,8 @@ void DecoderAutomata::feeder() {
           feeder_next_frame_ = -1;
         }
       }
-      feeder_current_frame_++;
+      feeder_current_frame_ =
+          next_frame_number(encoded_data_[fdi], feeder_current_frame_);
 
       // Set a discontinuity if we sent an empty packet to reset
       // the stream next time
@@ -326,11 +414,20 @@ void DecoderAutomata::feeder() {
       } else {
         seen_metadata = true;
       }
-      std::this_thread::yield();
+    }
+    if (profiler_) {
+      profiler_->increment("decode_thread_cpu_ns", cpu_nanos() - cpu_start);
     }
   }
 }
 
+void DecoderAutomata::notify_frames_changed() {
+  // Taking the lock makes sure a thread which just found no change in its
+  // wait predicate is already waiting when it is notified
+  { std::unique_lock<std::mutex> lk(feeder_mutex_); }
+  wake_feeder_.notify_all();
+}
+
 void DecoderAutomata::set_feeder_idx(i32 data_idx) {
   feeder_data_idx_ = data_idx;
   feeder_valid_idx_ = 0;
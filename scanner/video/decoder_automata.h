@@ -37,6 +37,13 @@ class DecoderAutomata {
 
   void initialize(const std::vector<proto::DecodeArgs>& encoded_data);
 
+  // Makes get_frames return frames of the output_info shape instead of full
+  // resolution RGB. Requires can_convert_frames() unless the shapes match.
+  void initialize(const std::vector<proto::DecodeArgs>& encoded_data,
+                  const FrameInfo& output_info);
+
+  bool can_convert_frames() { return decoder_->can_convert_frames(); }
+
   void get_frames(u8* buffer, i32 num_frames);
 
   void set_profiler(Profiler* profiler);
@@ -46,6 +53,9 @@ class DecoderAutomata {
 
   void set_feeder_idx(i32 data_idx);
 
+  // Wakes the other thread after frames were decoded or consumed
+  void notify_frames_changed();
+
   const i32 MAX_BUFFERED_FRAMES = 8;
 
   Profiler* profiler_ = nullptr;
@@ -59,6 +69,7 @@ class DecoderAutomata {
   std::atomic<bool> not_done_;
 
   FrameInfo info_{};
+  FrameInfo output_info_{};
   size_t frame_size_;
   i32 current_frame_;
   std::atomic<i32> reset_current_frame_;
@@ -80,6 +91,9 @@ class DecoderAutomata {
 
   std::atomic<size_t> feeder_buffer_offset_;
   std::atomic<i64> feeder_next_keyframe_;
+  // Guards handoffs between the feeder and get_frames. Both threads wait on
+  // wake_feeder_ instead of polling the decoder, so it is notified whenever
+  // frames are decoded or consumed as well as when the feeder changes state.
   std::mutex feeder_mutex_;
   std::condition_variable wake_feeder_;
 };
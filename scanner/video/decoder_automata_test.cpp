@@ -14,15 +14,115 @@
  */
 
 #include "scanner/video/decoder_automata.h"
+#include "scanner/video/gop_decoder_pool.h"
+#include "scanner/video/h264_byte_stream_index_creator.h"
+#include "scanner/video/video_encoder.h"
 #include "scanner/util/fs.h"
 #include "tests/videos.h"
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <iostream>
 #include <thread>
 
 namespace scanner {
 namespace internal {
+namespace {
+// Decode args covering every stride-th frame of the whole video in buffer
+std::vector<proto::DecodeArgs> make_decode_args(const VideoMetadata& video_meta,
+                                                u8* buffer, size_t size,
+                                                i64 stride) {
+  std::vector<proto::DecodeArgs> args(1);
+  proto::DecodeArgs& decode_args = args.back();
+  decode_args.set_width(video_meta.width());
+  decode_args.set_height(video_meta.height());
+  decode_args.set_start_keyframe(0);
+  decode_args.set_end_keyframe(video_meta.frames());
+  for (i64 r = 0; r < video_meta.frames(); r += stride) {
+    decode_args.add_valid_frames(r);
+  }
+  for (i64 k : video_meta.keyframe_positions()) {
+    decode_args.add_keyframes(k);
+  }
+  for (i64 k : video_meta.keyframe_byte_offsets()) {
+    decode_args.add_keyframe_byte_offsets(k);
+  }
+  for (bool v : video_meta.reference_frames()) {
+    decode_args.add_reference_frames(v);
+  }
+  decode_args.set_encoded_video((i64)buffer);
+  decode_args.set_encoded_video_size(size);
+  return args;
+}
+
+// Decodes every frame of a video one at a time and returns a checksum of
+// each frame if requested
+std::vector<u64> decode_all_frames(const VideoMetadata& video_meta,
+                                   const std::vector<u8>& video_bytes,
+                                   bool checksum = true) {
+  DecoderAutomata decoder(CPU_DEVICE, 1, VideoDecoderType::SOFTWARE);
+  u8* video_buffer = new_buffer(CPU_DEVICE, video_bytes.size());
+  memcpy_buffer(video_buffer, CPU_DEVICE, video_bytes.data(), CPU_DEVICE,
+                video_bytes.size());
+
+  std::vector<proto::DecodeArgs> args =
+      make_decode_args(video_meta, video_buffer, video_bytes.size(), 1);
+  decoder.initialize(args);
+
+  std::vector<u8> frame_buffer(video_meta.width() * video_meta.height() * 3);
+  std::vector<u64> checksums;
+  for (i64 i = 0; i < video_meta.frames(); ++i) {
+    decoder.get_frames(frame_buffer.data(), 1);
+    if (!checksum) {
+      continue;
+    }
+    // FNV-1a
+    u64 hash = 14695981039346656037ULL;
+    for (u8 b : frame_buffer) {
+      hash = (hash ^ b) * 1099511628211ULL;
+    }
+    checksums.push_back(hash);
+  }
+  return checksums;
+}
+
+// Decodes every frame of a video to the given format and returns the mean
+// luma of each frame
+std::vector<f64> mean_luma(const VideoMetadata& video_meta,
+                           const std::vector<u8>& video_bytes,
+                           const FrameInfo& info) {
+  DecoderAutomata decoder(CPU_DEVICE, 1, VideoDecoderType::SOFTWARE);
+  EXPECT_TRUE(decoder.can_convert_frames());
+  u8* video_buffer = new_buffer(CPU_DEVICE, video_bytes.size());
+  memcpy_buffer(video_buffer, CPU_DEVICE, video_bytes.data(), CPU_DEVICE,
+                video_bytes.size());
+
+  std::vector<proto::DecodeArgs> args =
+      make_decode_args(video_meta, video_buffer, video_bytes.size(), 1);
+  decoder.initialize(args, info);
+
+  std::vector<u8> frame_buffer(info.size());
+  std::vector<f64> luma;
+  for (i64 i = 0; i < video_meta.frames(); ++i) {
+    decoder.get_frames(frame_buffer.data(), 1);
+    f64 sum = 0;
+    for (size_t p = 0; p < frame_buffer.size(); p += info.channels()) {
+      sum += info.channels() == 1
+                 ? frame_buffer[p]
+                 : 0.299 * frame_buffer[p] + 0.587 * frame_buffer[p + 1] +
+                       0.114 * frame_buffer[p + 2];
+    }
+    luma.push_back(sum / (frame_buffer.size() / info.channels()));
+  }
+  return luma;
+}
+
+// Gray level of each frame of a fade, far enough apart to tell frames apart
+// after lossy encoding
+u8 fade_level(i64 frame) { return static_cast<u8>(16 + 8 * frame); }
+}
+
 TEST(DecoderAutomata, GetAllFrames) {
   MemoryPoolConfig config;
   init_memory_allocators(config, {});
@@ -122,5 +222,269 @@ TEST(DecoderAutomata, GetStridedFrames) {
   delete storage;
   destroy_memory_allocators();
 }
+
+// x264 encodes a fade with B-frames, which are shown before the frames they
+// are decoded after. Reference flags in decode order would then drop the
+// wrong frames, so the index creator withholds them and every third frame
+// still decodes to the requested one.
+TEST(DecoderAutomata, GetStridedFramesOfReorderedVideo) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+
+  auto storage = storehouse::StorageBackend::make_from_config(sc.get());
+  const i64 num_frames = 30;
+  FrameInfo frame_info(64, 64, 3, FrameType::U8);
+
+  // Encode the fade and index it as the save worker does
+  std::string video_path;
+  temp_file(video_path);
+  std::unique_ptr<storehouse::WriteFile> video_file;
+  BACKOFF_FAIL(make_unique_write_file(storage, video_path, video_file));
+  H264ByteStreamIndexCreator index_creator(video_file.get());
+  std::unique_ptr<VideoEncoder> encoder(VideoEncoder::make_from_config(
+      CPU_DEVICE, 1, VideoEncoderType::SOFTWARE));
+  EncodeOptions opts;
+  opts.quality = 10;
+  encoder->configure(frame_info, opts);
+  std::vector<u8> packet(4 * 1024 * 1024);
+  auto index_packets = [&](bool new_packet) {
+    while (new_packet) {
+      size_t packet_size;
+      new_packet =
+          encoder->get_packet(packet.data(), packet.size(), packet_size);
+      ASSERT_TRUE(index_creator.feed_packet(packet.data(), packet_size))
+          << index_creator.error_message();
+    }
+  };
+  std::vector<u8> frame_buffer(frame_info.size());
+  for (i64 i = 0; i < num_frames; ++i) {
+    std::fill(frame_buffer.begin(), frame_buffer.end(), fade_level(i));
+    index_packets(encoder->feed(frame_buffer.data(), frame_buffer.size()));
+  }
+  index_packets(encoder->flush());
+  BACKOFF_FAIL(video_file->save());
+  ASSERT_EQ(index_creator.frames(), num_frames);
+  EXPECT_TRUE(index_creator.reference_frames().empty());
+
+  std::vector<u8> video_bytes = read_entire_file(video_path);
+  u8* video_buffer = new_buffer(CPU_DEVICE, video_bytes.size());
+  memcpy_buffer(video_buffer, CPU_DEVICE, video_bytes.data(), CPU_DEVICE,
+                video_bytes.size());
+
+  proto::VideoDescriptor descriptor;
+  descriptor.set_frames(num_frames);
+  descriptor.set_width(frame_info.width());
+  descriptor.set_height(frame_info.height());
+  for (i64 k : index_creator.keyframe_positions()) {
+    descriptor.add_keyframe_positions(k);
+  }
+  for (i64 k : index_creator.keyframe_byte_offsets()) {
+    descriptor.add_keyframe_byte_offsets(k);
+  }
+  for (bool v : index_creator.reference_frames()) {
+    descriptor.add_reference_frames(v);
+  }
+  std::vector<proto::DecodeArgs> args = make_decode_args(
+      VideoMetadata(descriptor), video_buffer, video_bytes.size(), 3);
+
+  DecoderAutomata* decoder =
+      new DecoderAutomata(CPU_DEVICE, 1, VideoDecoderType::SOFTWARE);
+  decoder->initialize(args);
+  for (i64 r = 0; r < num_frames; r += 3) {
+    decoder->get_frames(frame_buffer.data(), 1);
+    f64 sum = 0;
+    for (u8 b : frame_buffer) {
+      sum += b;
+    }
+    EXPECT_NEAR(sum / frame_buffer.size(), fade_level(r), 3.0)
+        << "frame " << r;
+  }
+
+  delete decoder;
+  delete storage;
+  destroy_memory_allocators();
+}
+
+// Several automata decode at once, as with many pipeline instances per node,
+// and each returns the same frames as a lone decoder
+TEST(DecoderAutomata, ConcurrentDecodersMatch) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+
+  auto storage = storehouse::StorageBackend::make_from_config(sc.get());
+  VideoMetadata video_meta =
+      read_video_metadata(storage, download_video_meta(short_video));
+  std::vector<u8> video_bytes = read_entire_file(download_video(short_video));
+  std::vector<u64> expected = decode_all_frames(video_meta, video_bytes);
+  ASSERT_EQ(expected.size(), video_meta.frames());
+
+  const i32 num_decoders = 4;
+  std::vector<std::vector<u64>> frames(num_decoders);
+  std::vector<std::thread> threads;
+  for (i32 t = 0; t < num_decoders; ++t) {
+    threads.emplace_back([&, t]() {
+      frames[t] = decode_all_frames(video_meta, video_bytes);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (i32 t = 0; t < num_decoders; ++t) {
+    EXPECT_EQ(frames[t], expected) << "decoder " << t;
+  }
+
+  delete storage;
+  destroy_memory_allocators();
+}
+
+// Threads waiting on the decoder should not add to the CPU time per frame.
+// Run with --gtest_also_run_disabled_tests.
+TEST(DecoderAutomata, DISABLED_CpuTimePerFrame) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+
+  auto storage = storehouse::StorageBackend::make_from_config(sc.get());
+  VideoMetadata video_meta =
+      read_video_metadata(storage, download_video_meta(short_video));
+  std::vector<u8> video_bytes = read_entire_file(download_video(short_video));
+
+  const i32 num_decoders = 4;
+  auto start = now();
+  i64 cpu_start = cpu_nanos(true);
+  std::vector<std::thread> threads;
+  for (i32 t = 0; t < num_decoders; ++t) {
+    threads.emplace_back(
+        [&]() { decode_all_frames(video_meta, video_bytes, false); });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double cpu_us = (cpu_nanos(true) - cpu_start) / 1e3;
+  double wall_us = nano_since(start) / 1e3;
+  i64 frames = num_decoders * video_meta.frames();
+  std::cout << "Decoded " << frames << " frames: " << cpu_us / frames
+            << "us CPU time and " << wall_us / frames
+            << "us wall time per frame" << std::endl;
+
+  delete storage;
+  destroy_memory_allocators();
+}
+
+// Decoding straight to a downscaled gray frame shows the same picture as
+// decoding to full resolution RGB
+TEST(DecoderAutomata, DecodeToOutputFormat) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+
+  auto storage = storehouse::StorageBackend::make_from_config(sc.get());
+  VideoMetadata video_meta =
+      read_video_metadata(storage, download_video_meta(short_video));
+  std::vector<u8> video_bytes = read_entire_file(download_video(short_video));
+
+  FrameInfo rgb_info(video_meta.height(), video_meta.width(), 3,
+                     FrameType::U8);
+  FrameInfo gray_info(video_meta.height() / 2, video_meta.width() / 2, 1,
+                      FrameType::U8);
+  std::vector<f64> rgb_luma = mean_luma(video_meta, video_bytes, rgb_info);
+  std::vector<f64> gray_luma = mean_luma(video_meta, video_bytes, gray_info);
+  ASSERT_EQ(rgb_luma.size(), video_meta.frames());
+  ASSERT_EQ(gray_luma.size(), video_meta.frames());
+  for (size_t i = 0; i < rgb_luma.size(); ++i) {
+    EXPECT_NEAR(gray_luma[i], rgb_luma[i], 8.0) << "frame " << i;
+  }
+
+  delete storage;
+  destroy_memory_allocators();
+}
+
+// Decoding straight to a downscaled gray frame should be faster than
+// decoding to full resolution RGB, and needs a fraction of the memory. Run
+// with --gtest_also_run_disabled_tests.
+TEST(DecoderAutomata, DISABLED_DecodeToOutputFormatThroughput) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+
+  auto storage = storehouse::StorageBackend::make_from_config(sc.get());
+  VideoMetadata video_meta =
+      read_video_metadata(storage, download_video_meta(short_video));
+  std::vector<u8> video_bytes = read_entire_file(download_video(short_video));
+
+  FrameInfo rgb_info(video_meta.height(), video_meta.width(), 3,
+                     FrameType::U8);
+  FrameInfo gray_info(video_meta.height() / 2, video_meta.width() / 2, 1,
+                      FrameType::U8);
+  for (const FrameInfo& info : {rgb_info, gray_info}) {
+    auto start = now();
+    mean_luma(video_meta, video_bytes, info);
+    double seconds = nano_since(start) / 1e9;
+    std::cout << "Decoded " << video_meta.frames() << " " << info.width()
+              << "x" << info.height() << "x" << info.channels()
+              << " frames: " << video_meta.frames() / seconds << " fps, "
+              << info.size() << " bytes per frame" << std::endl;
+  }
+
+  delete storage;
+  destroy_memory_allocators();
+}
+
+// Decoding the GOPs of a video on several decoders returns the same frames
+// in the same order as decoding it on one
+TEST(GopDecoderPool, MatchesSingleDecoder) {
+  MemoryPoolConfig config;
+  init_memory_allocators(config, {});
+  std::unique_ptr<storehouse::StorageConfig> sc(
+      storehouse::StorageConfig::make_posix_config());
+
+  auto storage = storehouse::StorageBackend::make_from_config(sc.get());
+  VideoMetadata video_meta =
+      read_video_metadata(storage, download_video_meta(short_video));
+  std::vector<u8> video_bytes = read_entire_file(download_video(short_video));
+  FrameInfo info(video_meta.height(), video_meta.width(), 3, FrameType::U8);
+
+  auto make_args = [&]() {
+    // Pieces of a block buffer can be handed to different decoders
+    u8* video_buffer = new_block_buffer(CPU_DEVICE, video_bytes.size(), 1);
+    memcpy_buffer(video_buffer, CPU_DEVICE, video_bytes.data(), CPU_DEVICE,
+                  video_bytes.size());
+    return make_decode_args(video_meta, video_buffer, video_bytes.size(), 3);
+  };
+
+  std::vector<proto::DecodeArgs> gops;
+  split_into_gops(make_args(), gops);
+  EXPECT_EQ(gops.size(), video_meta.keyframe_positions().size());
+  for (auto& gop : gops) {
+    delete_buffer(CPU_DEVICE, (u8*)gop.encoded_video());
+  }
+
+  i64 num_frames = (video_meta.frames() + 2) / 3;
+  std::vector<u8> expected(info.size() * num_frames);
+  {
+    DecoderAutomata decoder(CPU_DEVICE, 1, VideoDecoderType::SOFTWARE);
+    decoder.initialize(make_args(), info);
+    decoder.get_frames(expected.data(), num_frames);
+  }
+
+  GopDecoderPool pool(CPU_DEVICE, 1, VideoDecoderType::SOFTWARE, 4);
+  std::vector<u8> frames(info.size() * num_frames);
+  pool.initialize(make_args(), info);
+  for (i64 i = 0; i < num_frames; i += 5) {
+    pool.get_frames(frames.data() + info.size() * i,
+                    std::min((i64)5, num_frames - i));
+  }
+  EXPECT_TRUE(frames == expected);
+
+  delete storage;
+  destroy_memory_allocators();
+}
 }
 }
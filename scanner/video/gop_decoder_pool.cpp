@@ -0,0 +1,239 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scanner/video/gop_decoder_pool.h"
+#include "scanner/util/memory.h"
+
+#include <algorithm>
+
+namespace scanner {
+namespace internal {
+
+void split_into_gops(const std::vector<proto::DecodeArgs>& encoded_data,
+                     std::vector<proto::DecodeArgs>& gops) {
+  for (const proto::DecodeArgs& args : encoded_data) {
+    if (args.keyframes_only() || args.keyframes_size() < 2 ||
+        args.keyframes_size() != args.keyframe_byte_offsets_size()) {
+      gops.push_back(args);
+      continue;
+    }
+    std::vector<i64> keyframes(args.keyframes().begin(),
+                               args.keyframes().end());
+    std::vector<i64> offsets(args.keyframe_byte_offsets().begin(),
+                             args.keyframe_byte_offsets().end());
+    // Keyframes normally end with end_keyframe and the end of the buffer
+    if (keyframes.back() < args.end_keyframe()) {
+      keyframes.push_back(args.end_keyframe());
+      offsets.push_back(args.encoded_video_size());
+    }
+
+    u8* buffer = (u8*)args.encoded_video();
+    size_t first = gops.size();
+    i32 v = 0;
+    for (size_t k = 0; k + 1 < keyframes.size(); ++k) {
+      i64 gop_end = keyframes[k + 1];
+      if (v == args.valid_frames_size() || args.valid_frames(v) >= gop_end) {
+        continue;
+      }
+      gops.emplace_back();
+      proto::DecodeArgs& gop = gops.back();
+      gop.set_width(args.width());
+      gop.set_height(args.height());
+      gop.set_start_keyframe(keyframes[k]);
+      gop.set_end_keyframe(gop_end);
+      gop.add_keyframes(keyframes[k]);
+      gop.add_keyframes(gop_end);
+      gop.add_keyframe_byte_offsets(0);
+      gop.add_keyframe_byte_offsets(offsets[k + 1] - offsets[k]);
+      gop.set_encoded_video((i64)(buffer + offsets[k]));
+      gop.set_encoded_video_size(offsets[k + 1] - offsets[k]);
+      gop.set_table_id(args.table_id());
+      gop.set_column_id(args.column_id());
+      gop.set_item_start_row(args.item_start_row());
+      for (; v < args.valid_frames_size() && args.valid_frames(v) < gop_end;
+           ++v) {
+        gop.add_valid_frames(args.valid_frames(v));
+      }
+      for (i64 f = keyframes[k] - args.start_keyframe();
+           f < gop_end - args.start_keyframe() &&
+           f < args.reference_frames_size();
+           ++f) {
+        gop.add_reference_frames(args.reference_frames(f));
+      }
+    }
+
+    // Each piece is deleted on its own, which only works within a block
+    i32 pieces = gops.size() - first;
+    if (pieces < 2 || !add_block_buffer_refs(CPU_DEVICE, buffer, pieces - 1)) {
+      gops.resize(first);
+      gops.push_back(args);
+    }
+  }
+}
+
+GopDecoderPool::GopDecoderPool(DeviceHandle device_handle, i32 num_devices,
+                               VideoDecoderType decoder_type,
+                               i32 num_decoders) {
+  // Frames are passed from the workers through host memory
+  if (decoder_type != VideoDecoderType::SOFTWARE) {
+    num_decoders = 1;
+  }
+  slots_.resize(std::max(num_decoders, 1));
+  for (Slot& slot : slots_) {
+    slot.decoder.reset(
+        new DecoderAutomata(device_handle, num_devices, decoder_type));
+  }
+  if (slots_.size() > 1) {
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      workers_.emplace_back(&GopDecoderPool::worker, this, i);
+    }
+  }
+}
+
+GopDecoderPool::~GopDecoderPool() {
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    stopping_ = true;
+  }
+  wake_workers_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void GopDecoderPool::initialize(
+    const std::vector<proto::DecodeArgs>& encoded_data,
+    const FrameInfo& output_info) {
+  std::vector<proto::DecodeArgs> gops;
+  if (!workers_.empty()) {
+    split_into_gops(encoded_data, gops);
+  }
+
+  std::unique_lock<std::mutex> lk(mutex_);
+  assert(idle());
+  gops_.clear();
+  gop_first_frames_.clear();
+  next_gop_ = 0;
+  total_frames_ = 0;
+  delivered_ = 0;
+  if (gops.size() < 2) {
+    // Nothing to decode concurrently, so the first decoder is used directly
+    lk.unlock();
+    slots_[0].decoder->initialize(gops.empty() ? encoded_data : gops,
+                                  output_info);
+    return;
+  }
+
+  output_info_ = output_info;
+  frame_size_ = output_info.size();
+  gops_ = std::move(gops);
+  for (const proto::DecodeArgs& gop : gops_) {
+    gop_first_frames_.push_back(total_frames_);
+    total_frames_ += gop.valid_frames_size();
+  }
+  if (profiler_) {
+    profiler_->increment("gops_decoded_in_parallel", gops_.size());
+  }
+  lk.unlock();
+  wake_workers_.notify_all();
+}
+
+void GopDecoderPool::get_frames(u8* buffer, i32 num_frames) {
+  if (gops_.empty()) {
+    slots_[0].decoder->get_frames(buffer, num_frames);
+    return;
+  }
+
+  auto start = now();
+  {
+    std::unique_lock<std::mutex> lk(mutex_);
+    assert(delivered_ + num_frames <= total_frames_);
+    output_ = buffer;
+    output_start_ = delivered_;
+    output_end_ = delivered_ + num_frames;
+    output_remaining_ = num_frames;
+    wake_workers_.notify_all();
+    wake_consumer_.wait(lk, [&] { return output_remaining_ == 0; });
+    delivered_ = output_end_;
+    output_ = nullptr;
+    output_start_ = output_end_;
+  }
+  if (profiler_) {
+    profiler_->add_interval("gop_get_frames", start, now());
+  }
+}
+
+void GopDecoderPool::set_profiler(Profiler* profiler) {
+  profiler_ = profiler;
+  for (Slot& slot : slots_) {
+    slot.decoder->set_profiler(profiler);
+  }
+}
+
+void GopDecoderPool::worker(i32 slot_idx) {
+  Slot& slot = slots_[slot_idx];
+  while (true) {
+    i64 gop;
+    {
+      std::unique_lock<std::mutex> lk(mutex_);
+      wake_workers_.wait(lk, [&] {
+        return stopping_ ||
+               (slot.gop < 0 && next_gop_ < (i64)gops_.size());
+      });
+      if (stopping_) {
+        break;
+      }
+      gop = next_gop_++;
+      slot.gop = gop;
+      slot.decoded = 0;
+    }
+    slot.decoder->initialize({gops_[gop]}, output_info_);
+
+    i64 first_frame = gop_first_frames_[gop];
+    i64 num_frames = gops_[gop].valid_frames_size();
+    while (slot.decoded < num_frames) {
+      // Frames are only decoded once get_frames has a buffer for them
+      i64 frame = first_frame + slot.decoded;
+      u8* output;
+      i64 count;
+      {
+        std::unique_lock<std::mutex> lk(mutex_);
+        wake_workers_.wait(lk, [&] {
+          return stopping_ || (output_start_ <= frame && frame < output_end_);
+        });
+        if (stopping_) {
+          return;
+        }
+        output = output_ + (frame - output_start_) * frame_size_;
+        count = std::min(num_frames - slot.decoded, output_end_ - frame);
+      }
+      slot.decoder->get_frames(output, count);
+      {
+        std::unique_lock<std::mutex> lk(mutex_);
+        slot.decoded += count;
+        output_remaining_ -= count;
+        if (slot.decoded == num_frames) {
+          // Frees the slot for the next GOP
+          slot.gop = -1;
+        }
+      }
+      wake_consumer_.notify_all();
+      wake_workers_.notify_all();
+    }
+  }
+}
+}
+}
@@ -0,0 +1,108 @@
+/* Copyright 2016 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "scanner/video/decoder_automata.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+// Decoders a node gives each pipeline instance at most
+static const i32 MAX_GOP_DECODERS = 8;
+
+// Splits decode args which span several GOPs into one decode args per GOP
+// with requested frames. The pieces of one decode args point into its block
+// buffer, which gains a ref for each extra piece. Decode args of keyframes
+// only or whose buffer is not in a block are kept whole.
+void split_into_gops(const std::vector<proto::DecodeArgs>& encoded_data,
+                     std::vector<proto::DecodeArgs>& gops);
+
+/// Decodes the GOPs of the decode args of an io item concurrently.
+///
+/// Each GOP starts at a keyframe, so GOPs are decoded independently by a
+/// pool of decoders, each on its own thread. Decoders take GOPs in order and
+/// each GOP knows the position of its first frame among the frames of the io
+/// item. get_frames publishes the positions its buffer holds and every
+/// decoder writes the frames of its GOP in that range straight into the
+/// buffer, so the pool returns the same frames as a single DecoderAutomata
+/// without copying them. A decoder only starts its next GOP once its current
+/// one is fully decoded.
+///
+/// With a single decoder, or decode args which do not split, frames are
+/// decoded by one DecoderAutomata on the calling thread as before.
+class GopDecoderPool {
+ public:
+  GopDecoderPool(DeviceHandle device_handle, i32 num_devices,
+                 VideoDecoderType decoder_type, i32 num_decoders);
+  ~GopDecoderPool();
+
+  void initialize(const std::vector<proto::DecodeArgs>& encoded_data,
+                  const FrameInfo& output_info);
+
+  bool can_convert_frames() { return slots_[0].decoder->can_convert_frames(); }
+
+  void get_frames(u8* buffer, i32 num_frames);
+
+  void set_profiler(Profiler* profiler);
+
+ private:
+  struct Slot {
+    std::unique_ptr<DecoderAutomata> decoder;
+    // GOP being decoded, with its frames decoded so far
+    i64 gop = -1;
+    i64 decoded = 0;
+  };
+
+  void worker(i32 slot_idx);
+
+  // Whether the frames of the current GOPs have all been handed out
+  bool idle() const { return delivered_ == total_frames_; }
+
+  Profiler* profiler_ = nullptr;
+  std::vector<Slot> slots_;
+  std::vector<std::thread> workers_;
+  FrameInfo output_info_{};
+  size_t frame_size_ = 0;
+  bool stopping_ = false;
+
+  // GOPs of the current io item, the position of the first frame of each
+  // and the next one to be taken by a worker
+  std::vector<proto::DecodeArgs> gops_;
+  std::vector<i64> gop_first_frames_;
+  i64 next_gop_ = 0;
+  i64 total_frames_ = 0;
+  i64 delivered_ = 0;
+
+  // Buffer of the current get_frames call, which holds the frames at
+  // positions [output_start_, output_end_), and how many are left to decode
+  u8* output_ = nullptr;
+  i64 output_start_ = 0;
+  i64 output_end_ = 0;
+  i64 output_remaining_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable wake_workers_;
+  std::condition_variable wake_consumer_;
+};
+}
+}
@@ -36,6 +36,7 @@ extern "C" {
 #include "libswscale/swscale.h"
 }
 
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 
@@ -88,33 +89,12 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
         saw_sps_nal_ = false;
       }
     }
-    std::vector<u8> rbsp_buffer;
-    rbsp_buffer.reserve(64 * 1024);
-    u32 consecutive_zeros = 0;
-    i32 bytes = nal_size - 1;
-    const u8* pb = nal_start + 1;
-    while (bytes > 0) {
-      /* Copy the byte into the rbsp, unless it
-       * is the 0x03 in a 0x000003 */
-      if (consecutive_zeros < 2 || *pb != 0x03) {
-        rbsp_buffer.push_back(*pb);
-      }
-      if (*pb == 0) {
-        ++consecutive_zeros;
-      } else {
-        consecutive_zeros = 0;
-      }
-      ++pb;
-      --bytes;
-    }
-
     // We need to track the last SPS NAL because some streams do
     // not insert an SPS every keyframe and we need to insert it
-    // ourselves.
-    // fprintf(stderr, "nal_size %d, rbsp size %lu\n", nal_size,
-    // rbsp_buffer.size());
-    const u8* rbsp_start = rbsp_buffer.data();
-    i32 rbsp_size = rbsp_buffer.size();
+    // ourselves. Parameter sets are read in place, skipping emulation
+    // prevention bytes as they are reached.
+    const u8* rbsp_start = nal_start + 1;
+    i32 rbsp_size = nal_size - 1;
 
     // SPS
     if (nal_unit_type == 7) {
@@ -123,6 +103,8 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
       GetBitsState gb;
       gb.buffer = rbsp_start;
       gb.offset = 0;
+      gb.size = rbsp_size;
+      gb.rbsp = true;
       SPS sps;
       if (!parse_sps(gb, sps)) {
         error_message_ = "Failed to parse sps";
@@ -143,6 +125,8 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
       GetBitsState gb;
       gb.buffer = rbsp_start;
       gb.offset = 0;
+      gb.size = rbsp_size;
+      gb.rbsp = true;
       PPS pps;
       if (!parse_pps(gb, pps)) {
         error_message_ = "Failed to parse pps";
@@ -164,6 +148,8 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
       GetBitsState gb;
       gb.buffer = nal_start;
       gb.offset = 8;
+      gb.size = nal_size;
+      gb.rbsp = true;
       SliceHeader sh;
       if (!parse_slice_header(gb, sps_map_.at(last_sps_), pps_map_,
                               nal_unit_type, nal_ref_idc, sh)) {
@@ -174,6 +160,17 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
       // sh.num_ref_idx_l0_active, sh.num_ref_idx_l1_active);
       if (frame_ == 0 || is_new_access_unit(sps_map_, pps_map_, prev_sh_, sh)) {
         frame_++;
+        if (!reorders_frames_ &&
+            !in_display_order(sps_map_.at(last_sps_), sh)) {
+          VLOG(1) << "Frame " << frame_ - 1 << " is shown out of decode "
+                  << "order, so no frames will be dropped before decoding";
+          reorders_frames_ = true;
+          reference_frames_.clear();
+        }
+        if (!reorders_frames_) {
+          // All slices of a picture share the same nal_ref_idc
+          reference_frames_.push_back(nal_ref_idc != 0);
+        }
         size_t bytestream_offset;
         if (nal_unit_type == 5) {
           // Insert an SPS NAL if we did not see one in the meta packet
@@ -226,5 +223,41 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
   }
   return true;
 }
+
+// Whether the access unit starting with the given slice is shown after the
+// one decoded before it. Order counts are only tracked for frame coded
+// streams with pic_order_cnt_type 0, others count as reordered unless they
+// use type 2, where display order always equals decode order.
+bool H264ByteStreamIndexCreator::in_display_order(const SPS& sps,
+                                                  const SliceHeader& sh) {
+  if (sps.poc_type == 2) {
+    return true;
+  }
+  if (sps.poc_type != 0 || !sps.frame_mbs_only_flag) {
+    return false;
+  }
+  bool idr = sh.nal_unit_type == 5;
+  if (idr) {
+    prev_poc_msb_ = 0;
+    prev_poc_lsb_ = 0;
+  }
+  i64 max_lsb = (i64)1 << sps.log2_max_pic_order_cnt_lsb;
+  i64 lsb = sh.pic_order_cnt_lsb;
+  i64 msb = prev_poc_msb_;
+  if (lsb < prev_poc_lsb_ && prev_poc_lsb_ - lsb >= max_lsb / 2) {
+    msb += max_lsb;
+  } else if (lsb > prev_poc_lsb_ && lsb - prev_poc_lsb_ > max_lsb / 2) {
+    msb -= max_lsb;
+  }
+  if (sh.nal_ref_idc != 0) {
+    prev_poc_msb_ = msb;
+    prev_poc_lsb_ = lsb;
+  }
+  i64 poc = std::min(msb + lsb, msb + lsb + sh.delta_pic_order_cnt_bottom);
+  // An IDR frame is shown only after every frame before it
+  bool in_order = idr || poc > last_poc_;
+  last_poc_ = poc;
+  return in_order;
+}
 }
 }
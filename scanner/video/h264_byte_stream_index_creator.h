@@ -40,6 +40,11 @@ class H264ByteStreamIndexCreator {
     return keyframe_byte_offsets_;
   };
 
+  // Whether each frame is used as a reference by other frames. Frames are
+  // only known to be droppable when they are shown in the order they are
+  // decoded, so this is empty for streams which reorder frames.
+  const std::vector<bool>& reference_frames() { return reference_frames_; }
+
   i32 frames() { return frame_; };
   i32 num_non_ref_frames() { return num_non_ref_frames_; };
   i32 nals_parsed() { return nals_parsed_; };
@@ -56,6 +61,8 @@ class H264ByteStreamIndexCreator {
   std::vector<i64> keyframe_positions_;
   std::vector<i64> keyframe_timestamps_;
   std::vector<i64> keyframe_byte_offsets_;
+  std::vector<bool> reference_frames_;
+  bool reorders_frames_ = false;
 
   i64 frame_ = 0;
   bool in_meta_packet_sequence_ = false;
@@ -69,6 +76,12 @@ class H264ByteStreamIndexCreator {
   std::map<u32, std::vector<u8>> sps_nal_bytes_;
   std::map<u32, std::vector<u8>> pps_nal_bytes_;
   SliceHeader prev_sh_;
+  // Picture order count state of 8.2.1.1 in the H.264 spec
+  i64 prev_poc_msb_ = 0;
+  i64 prev_poc_lsb_ = 0;
+  i64 last_poc_ = 0;
+
+  bool in_display_order(const SPS& sps, const SliceHeader& sh);
 
   i32 num_non_ref_frames_ = 0;
   i32 nals_parsed_ = 0;
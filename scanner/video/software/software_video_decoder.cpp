@@ -64,8 +64,7 @@ SoftwareVideoDecoder::SoftwareVideoDecoder(i32 device_id,
     exit(EXIT_FAILURE);
   }
 
-  // cc_->thread_count = thread_count;
-  cc_->thread_count = 4;
+  cc_->thread_count = thread_count;
 
   if (avcodec_open2(cc_, codec_, NULL) < 0) {
     fprintf(stderr, "could not open codec\n");
@@ -98,12 +97,24 @@ void SoftwareVideoDecoder::configure(const FrameInfo& metadata) {
   metadata_ = metadata;
   frame_width_ = metadata_.width();
   frame_height_ = metadata_.height();
+  output_width_ = frame_width_;
+  output_height_ = frame_height_;
+  output_pixel_format_ = AV_PIX_FMT_RGB24;
   reset_context_ = true;
+}
 
-  int required_size = av_image_get_buffer_size(AV_PIX_FMT_RGB24, frame_width_,
-                                               frame_height_, 1);
-
-  conversion_buffer_.resize(required_size);
+void SoftwareVideoDecoder::set_output_format(const FrameInfo& output) {
+  assert(output.type == FrameType::U8);
+  assert(output.channels() == 1 || output.channels() == 3);
+  AVPixelFormat pixel_format =
+      output.channels() == 1 ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_RGB24;
+  if (output.width() != output_width_ || output.height() != output_height_ ||
+      pixel_format != output_pixel_format_) {
+    output_width_ = output.width();
+    output_height_ = output.height();
+    output_pixel_format_ = pixel_format;
+    reset_context_ = true;
+  }
 }
 
 bool SoftwareVideoDecoder::feed(const u8* encoded_buffer, size_t encoded_size,
@@ -191,9 +202,14 @@ bool SoftwareVideoDecoder::get_frame(u8* decoded_buffer, size_t decoded_size) {
     auto get_context_start = now();
     AVPixelFormat decoder_pixel_format = cc_->pix_fmt;
     sws_freeContext(sws_context_);
+    // Scaling and pixel format conversion happen in the same pass. Area
+    // averaging is cheaper than bicubic filtering and better for downscaling.
+    bool downscale =
+        output_width_ < frame_width_ || output_height_ < frame_height_;
     sws_context_ = sws_getContext(
-        frame_width_, frame_height_, decoder_pixel_format, frame_width_,
-        frame_height_, AV_PIX_FMT_RGB24, SWS_BICUBIC, NULL, NULL, NULL);
+        frame_width_, frame_height_, decoder_pixel_format, output_width_,
+        output_height_, output_pixel_format_,
+        downscale ? SWS_AREA : SWS_BICUBIC, NULL, NULL, NULL);
     reset_context_ = false;
     auto get_context_end = now();
     if (profiler_) {
@@ -203,16 +219,16 @@ bool SoftwareVideoDecoder::get_frame(u8* decoded_buffer, size_t decoded_size) {
   }
 
   if (sws_context_ == NULL) {
-    LOG(FATAL) << "Could not get sws_context for rgb conversion";
+    LOG(FATAL) << "Could not get sws_context for frame conversion";
   }
 
   u8* scale_buffer = decoded_buffer;
 
   uint8_t* out_slices[4];
   int out_linesizes[4];
-  int required_size =
-      av_image_fill_arrays(out_slices, out_linesizes, scale_buffer,
-                           AV_PIX_FMT_RGB24, frame_width_, frame_height_, 1);
+  int required_size = av_image_fill_arrays(
+      out_slices, out_linesizes, scale_buffer, output_pixel_format_,
+      output_width_, output_height_, 1);
   if (required_size < 0) {
     LOG(FATAL) << "Error in av_image_fill_arrays";
   }
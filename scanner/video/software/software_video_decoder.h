@@ -47,6 +47,10 @@ class SoftwareVideoDecoder : public VideoDecoder {
 
   void configure(const FrameInfo& metadata) override;
 
+  bool can_convert_frames() override { return true; }
+
+  void set_output_format(const FrameInfo& output) override;
+
   bool feed(const u8* encoded_buffer, size_t encoded_size,
             bool discontinuity = false) override;
 
@@ -70,7 +74,9 @@ class SoftwareVideoDecoder : public VideoDecoder {
   FrameInfo metadata_;
   i32 frame_width_;
   i32 frame_height_;
-  std::vector<u8> conversion_buffer_;
+  i32 output_width_;
+  i32 output_height_;
+  AVPixelFormat output_pixel_format_;
   bool reset_context_;
   SwsContext* sws_context_;
 
@@ -50,6 +50,7 @@ SoftwareVideoEncoder::SoftwareVideoEncoder(i32 device_id,
                                            i32 thread_count)
   : device_id_(device_id),
     output_type_(output_type),
+    thread_count_(thread_count),
     codec_(nullptr),
     cc_(nullptr),
     sws_context_(nullptr),
@@ -117,7 +118,8 @@ void SoftwareVideoEncoder::configure(const FrameInfo& metadata,
   int required_size = av_image_get_buffer_size(AV_PIX_FMT_RGB24, frame_width_,
                                                frame_height_, 1);
 
-  cc_->thread_count = 4;
+  cc_->thread_count =
+      opts.thread_count > 0 ? opts.thread_count : thread_count_;
   cc_->width = frame_width_;    // Note Resolution must be a multiple of 2!!
   cc_->height = frame_height_;  // Note Resolution must be a multiple of 2!!
   // TODO(apoms): figure out this fps from the input video automatically
@@ -63,6 +63,7 @@ class SoftwareVideoEncoder : public VideoEncoder {
 
   int device_id_;
   DeviceType output_type_;
+  i32 thread_count_;
   AVCodec* codec_;
   AVCodecContext* cc_;
   AVBitStreamFilterContext* annexb_;
@@ -48,6 +48,14 @@ class VideoDecoder {
 
   virtual void configure(const FrameInfo& metadata) = 0;
 
+  //! Whether get_frame can scale frames and convert them to gray as well
+  virtual bool can_convert_frames() { return false; }
+
+  //! Makes get_frame produce U8 frames of the given (height, width,
+  //! channels) shape, with 1 or 3 channels. Only valid if can_convert_frames.
+  //! configure resets this to full resolution RGB.
+  virtual void set_output_format(const FrameInfo& output) {}
+
   virtual bool feed(const u8* encoded_buffer, size_t encoded_size,
                     bool discontinuity = false) = 0;
 
@@ -34,6 +34,8 @@ enum class VideoEncoderType {
 struct EncodeOptions {
   i32 quality = -1;
   i64 bitrate = -1;
+  // Threads of the codec context, or -1 to use those the encoder was made with
+  i32 thread_count = -1;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
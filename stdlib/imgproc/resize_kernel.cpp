@@ -6,6 +6,29 @@
 #include "stdlib/stdlib.pb.h"
 
 namespace scanner {
+namespace {
+
+// Shape of the frames produced for frames of the input shape
+FrameInfo resized_frame_info(const proto::ResizeArgs& args,
+                             const FrameInfo& input) {
+  i32 target_width = args.width();
+  i32 target_height = args.height();
+  if (args.preserve_aspect()) {
+    if (target_width == 0) {
+      target_width = input.width() * target_height / input.height();
+    } else {
+      target_height = input.height() * target_width / input.width();
+    }
+  }
+  if (args.min()) {
+    if (input.width() <= target_width && input.height() <= target_height) {
+      target_width = input.width();
+      target_height = input.height();
+    }
+  }
+  return FrameInfo(target_height, target_width, 3, FrameType::U8);
+}
+}
 
 class ResizeKernel : public VideoKernel {
  public:
@@ -20,27 +43,12 @@ class ResizeKernel : public VideoKernel {
     set_device();
     check_frame(device_, frame_col[0]);
 
-    i32 target_width = args_.width();
-    i32 target_height = args_.height();
-    if (args_.preserve_aspect()) {
-      if (target_width == 0) {
-        target_width =
-            frame_info_.width() * target_height / frame_info_.height();
-      } else {
-        target_height =
-            frame_info_.height() * target_width / frame_info_.width();
-      }
-    }
-    if (args_.min()) {
-      if (frame_info_.width() <= target_width &&
-          frame_info_.height() <= target_height) {
-        target_width = frame_info_.width();
-        target_height = frame_info_.height();
-      }
-    }
+    // Frames may already have been decoded to the target size
+    FrameInfo info = resized_frame_info(args_, frame_info_);
+    i32 target_width = info.width();
+    i32 target_height = info.height();
 
     i32 input_count = num_rows(frame_col);
-    FrameInfo info(target_height, target_width, 3, FrameType::U8);
     std::vector<Frame*> output_frames = new_frames(device_, info, input_count);
 
     for (i32 i = 0; i < input_count; ++i) {
@@ -73,7 +81,15 @@ class ResizeKernel : public VideoKernel {
   proto::ResizeArgs args_;
 };
 
-REGISTER_OP(Resize).frame_input("frame").frame_output("frame");
+REGISTER_OP(Resize)
+    .frame_input("frame")
+    .frame_output("frame")
+    .frame_format("frame",
+                  [](const std::vector<u8>& args, const FrameInfo& video) {
+                    proto::ResizeArgs resize_args;
+                    resize_args.ParseFromArray(args.data(), args.size());
+                    return resized_frame_info(resize_args, video);
+                  });
 
 REGISTER_KERNEL(Resize, ResizeKernel).device(DeviceType::CPU).num_devices(1);
 
@@ -44,7 +44,11 @@ class OpticalFlowKernelCPU : public VideoKernel {
 
     for (i32 i = 0; i < input_count; ++i) {
       cv::Mat input = frame_to_mat(input_columns[0][i].as_const_frame());
-      cv::cvtColor(input, grayscale_[i % 2], CV_BGR2GRAY);
+      if (input.channels() == 1) {
+        input.copyTo(grayscale_[i % 2]);
+      } else {
+        cv::cvtColor(input, grayscale_[i % 2], CV_BGR2GRAY);
+      }
       cv::Mat flow = frame_to_mat(frames[i]);
       if (i == 0) {
         if (initial_frame_.empty()) {
@@ -70,7 +74,14 @@ class OpticalFlowKernelCPU : public VideoKernel {
   i32 work_item_size_;
 };
 
-REGISTER_OP(OpticalFlow).frame_input("frame").frame_output("flow");
+REGISTER_OP(OpticalFlow)
+    .frame_input("frame")
+    .frame_output("flow")
+    .frame_format("frame",
+                  [](const std::vector<u8>& args, const FrameInfo& video) {
+                    return FrameInfo(video.height(), video.width(), 1,
+                                     FrameType::U8);
+                  });
 
 REGISTER_KERNEL(OpticalFlow, OpticalFlowKernelCPU)
     .device(DeviceType::CPU)
@@ -1,12 +1,97 @@
 #include "scanner/api/database.h"
+#include "scanner/api/kernel.h"
 #include "scanner/api/op.h"
+#include "scanner/engine/metadata.h"
 #include "scanner/util/fs.h"
+#include "scanner/util/memory.h"
 #include "stdlib/stdlib.pb.h"
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 
 namespace scanner {
 
+// Drops the odd rows below 50 so that, of a table split into items of 50
+// rows, only the first item loses rows
+class DropEarlyOddRowsKernel : public Kernel {
+ public:
+  DropEarlyOddRowsKernel(const Kernel::Config& config)
+    : Kernel(config), device_(config.devices[0]) {}
+
+  void execute(const BatchedColumns& input_columns,
+               BatchedColumns& output_columns) override {
+    const ElementList& indices = input_columns[0];
+    std::vector<i32> rows;
+    for (size_t i = 0; i < num_rows(indices); ++i) {
+      i64 index = *reinterpret_cast<const i64*>(indices[i].buffer);
+      if (index >= 50 || index % 2 == 0) {
+        rows.push_back(i);
+      }
+    }
+    select_rows(rows);
+    if (rows.empty()) {
+      return;
+    }
+    u8* output_block =
+        new_block_buffer(device_, rows.size() * sizeof(i64), rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+      u8* buffer = output_block + i * sizeof(i64);
+      std::memcpy(buffer, indices[rows[i]].buffer, sizeof(i64));
+      insert_element(output_columns[0], buffer, sizeof(i64));
+    }
+  }
+
+ private:
+  DeviceHandle device_;
+};
+
+REGISTER_OP(DropEarlyOddRows).input("index").output("index").filter();
+
+REGISTER_KERNEL(DropEarlyOddRows, DropEarlyOddRowsKernel)
+    .device(DeviceType::CPU)
+    .num_devices(1);
+
+static std::mutex recorded_indices_mutex;
+static std::vector<i64> recorded_indices;
+
+// Records every index it is given in recorded_indices
+class RecordIndexKernel : public Kernel {
+ public:
+  RecordIndexKernel(const Kernel::Config& config)
+    : Kernel(config), device_(config.devices[0]) {}
+
+  void execute(const BatchedColumns& input_columns,
+               BatchedColumns& output_columns) override {
+    const ElementList& indices = input_columns[0];
+    i32 input_count = (i32)num_rows(indices);
+    {
+      std::lock_guard<std::mutex> lock(recorded_indices_mutex);
+      for (i32 i = 0; i < input_count; ++i) {
+        recorded_indices.push_back(
+            *reinterpret_cast<const i64*>(indices[i].buffer));
+      }
+    }
+    if (input_count == 0) {
+      return;
+    }
+    u8* output_block = new_block_buffer(device_, 1, input_count);
+    for (i32 i = 0; i < input_count; ++i) {
+      insert_element(output_columns[0], output_block, 1);
+    }
+  }
+
+ private:
+  DeviceHandle device_;
+};
+
+REGISTER_OP(RecordIndex).input("index").output("dummy");
+
+REGISTER_KERNEL(RecordIndex, RecordIndexKernel)
+    .device(DeviceType::CPU)
+    .num_devices(1);
+
 // Fixtures are taken down after every test, so to avoid-redownloading and
 // ingesting the files, we use static globals.
 static bool downloaded = false;
@@ -97,16 +182,27 @@ class ScannerTest : public ::testing::Test {
   }
 
   scanner::Task range_task(std::string output_table_name) {
+    return gather_task("test", {"index", "frame"}, {{0, 100}},
+                       output_table_name);
+  }
+
+  // Gathers each [start, end) range of rows as its own item
+  scanner::Task gather_task(
+      std::string input_table_name, std::vector<std::string> column_names,
+      std::vector<std::pair<scanner::i64, scanner::i64>> ranges,
+      std::string output_table_name) {
     scanner::Task task;
     task.output_table_name = output_table_name;
     scanner::TableSample sample;
-    sample.table_name = "test";
-    sample.column_names = {"index", "frame"};
+    sample.table_name = input_table_name;
+    sample.column_names = column_names;
     sample.sampling_function = "Gather";
     scanner::proto::GatherSamplerArgs args;
-    auto& gather_sample = *args.add_samples();
-    for (int i = 0; i < 100; i += 1) {
-      gather_sample.add_rows(i);
+    for (auto& range : ranges) {
+      auto& gather_sample = *args.add_samples();
+      for (scanner::i64 i = range.first; i < range.second; i += 1) {
+        gather_sample.add_rows(i);
+      }
     }
     std::vector<scanner::u8> args_data(args.ByteSize());
     args.SerializeToArray(args_data.data(), args_data.size());
@@ -136,6 +232,54 @@ TEST_F(ScannerTest, NonLinearDAG) {
   run_task(range_task("NonLinearDAG"), output);
 }
 
+TEST_F(ScannerTest, SparseRowsReadBack) {
+  scanner::Op* input = scanner::make_input_op({"index"});
+  scanner::Op* filter = new scanner::Op(
+      "DropEarlyOddRows", {scanner::OpInput(input, {"index"})},
+      scanner::DeviceType::CPU);
+  scanner::Op* output =
+      scanner::make_output_op({scanner::OpInput(filter, {"index"})});
+  run_task(gather_task("test", {"index"}, {{0, 50}, {50, 100}},
+                       "SparseRowsReadBack"),
+           output);
+
+  // Only the item which lost rows records the ones it kept
+  std::unique_ptr<storehouse::StorageBackend> storage{
+      storehouse::StorageBackend::make_from_config(sc_.get())};
+  internal::DatabaseMetadata meta = internal::read_database_metadata(
+      storage.get(), internal::DatabaseMetadata::descriptor_path());
+  i32 table_id = meta.get_table_id("SparseRowsReadBack");
+  storehouse::FileInfo info;
+  EXPECT_EQ(storage->get_file_info(
+                internal::table_item_row_ids_path(table_id, 0), info),
+            storehouse::StoreResult::Success);
+  EXPECT_NE(storage->get_file_info(
+                internal::table_item_row_ids_path(table_id, 1), info),
+            storehouse::StoreResult::Success);
+
+  // Reading every row back skips the dropped ones and finds the rest where
+  // they were stored
+  recorded_indices.clear();
+  scanner::Op* reread_input = scanner::make_input_op({"index"});
+  scanner::Op* record = new scanner::Op(
+      "RecordIndex", {scanner::OpInput(reread_input, {"index"})},
+      scanner::DeviceType::CPU);
+  scanner::Op* reread_output =
+      scanner::make_output_op({scanner::OpInput(record, {"dummy"})});
+  run_task(gather_task("SparseRowsReadBack", {"index"}, {{0, 100}},
+                       "SparseRowsReadBackRecord"),
+           reread_output);
+
+  std::vector<i64> expected_indices;
+  for (i64 i = 0; i < 100; ++i) {
+    if (i >= 50 || i % 2 == 0) {
+      expected_indices.push_back(i);
+    }
+  }
+  std::sort(recorded_indices.begin(), recorded_indices.end());
+  EXPECT_EQ(recorded_indices, expected_indices);
+}
+
 #ifdef HAVE_CUDA
 
 TEST_F(ScannerTest, CPUToGPU) {